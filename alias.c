@@ -19,62 +19,126 @@
 
 #include "alias.h"
 
-#define MAX_ALIAS_VAL_LENGTH    200 // the maximum allowed number of chars per alias value
 #define MAX_ALIAS_KEY_LENGTH    50  // the maximum allowed number of chars per alias key
+#define MAX_ALIAS_DEPTH         32  // the maximum nesting of recursively expanded aliases
+#define ALIAS_SEPARATORS        " \t\n|;&()<>"    // the chars that end a word
+#define ALIAS_CMD_SEPARATORS    "\n|;&("           // the separators after which a cmd name follows
+#define ALIAS_MIN_SLOTS         16  // the initial nb of hash table slots (a power of 2)
+#define SLOT_EMPTY              -1
+#define SLOT_DELETED            -2
 
+/*
+ * The aliases are stored in an array, in insertion order (the order in which they are resolved
+ *  and printed), with holes for the unaliased ones. An open addressing hash table with linear
+ *  probing maps the keys to their index in that array; the array is compacted when the table
+ *  is rebuilt.
+ */
 struct alias {
-    char *key;
+    char *key;          // NULL iff unaliased
     char *value;
-    struct alias *next;
+    unsigned int hash;  // hash_key() of the key
+    bool global;        // whether it's expanded anywhere in the line, see expand_global_aliases()
 };
-//typedef struct alias ALIAS;
-//#define CREATE_ALIAS(k,v) (struct alias) {k, v}
 
-struct alias *head = NULL;
-struct alias *tail = NULL;
+/*
+ * The global alias keys are matched with an Aho-Corasick automaton: a trie of the keys, with the
+ *  children of a node in a linked list, and for every node a link to the longest proper suffix of
+ *  its prefix that is in the trie as well. It's rebuilt lazily, when the global keys have changed.
+ */
+struct ac_node {
+    int child;          // the first child, or -1
+    int sibling;        // the next child of the parent, or -1
+    unsigned char c;    // the char on the edge from the parent
+    int depth;          // the length of the prefix the node represents
+    int fail;           // the node of the longest proper suffix in the trie
+    int output;         // the index in aliases of the key ending in this node, or -1
+    int dict;           // the nearest node with an output on the fail chain, or -1
+};
+
+static struct alias *aliases = NULL;
+static int nb_entries = 0;          // nb of used array entries, including holes
+static int max_entries = 0;         // allocated length of the array
+static int *slots = NULL;           // the hash table: an index in aliases, or SLOT_EMPTY or SLOT_DELETED
+static int nb_slots = 0;            // a power of 2
+static int nb_used_slots = 0;       // nb of non-empty slots, including deleted ones
+static struct ac_node *ac_nodes = NULL;
+static int nb_ac_nodes = 0;
+static int max_ac_nodes = 0;
+static bool global_keys_changed = false;   // whether the automaton needs to be rebuilt
 
-int total_alias_val_length = 0;
 int nb_aliases = 0;
+int nb_global_aliases = 0;
 
 bool alias_key_changed = false;
 
+// #################### helper function definitions ####################
+unsigned int hash_key(const char*, size_t);
+int find_slot(const char*, size_t);
+void remove_alias(int);
+void rebuild_table(void);
+int add_alias(char*, char*, bool);
+bool expand_aliases(const char*, strbuf*, int*, int);
+void expand_global_aliases(const char*, strbuf*);
+void build_automaton(void);
+int ac_add_node(int, unsigned char);
+int ac_goto(int, unsigned char);
+bool is_word_char(char);
+
 /*
  * alias: create a mapping between a key and value pair that can be resolved with resolvealiases().
+ *  The value may itself use aliases: these are expanded when the alias is resolved.
  *  returns EXIT_SUCCESS or EXIT_FAILURE if something went wrong (e.g. malloc)
- *  (note that provided strings that are too long are silently truncated)
+ *  (note that provided keys that are too long are silently truncated)
  */
 int alias(char *k, char *v) {
-    // allow recursive alias definitions
-    char *val = resolvealiases(v);
+    return add_alias(k, v, false);
+}
+
+/*
+ * global_alias: create a global alias: a mapping that, unlike the one of alias(), is resolved in
+ *  any position of the line, e.g. `alias -g NUL /dev/null`.
+ *  returns EXIT_SUCCESS or EXIT_FAILURE if something went wrong (e.g. malloc)
+ */
+int global_alias(char *k, char *v) {
+    return add_alias(k, v, true);
+}
 
-    int vallength = strnlen(val, MAX_ALIAS_VAL_LENGTH);
+/*
+ * add_alias: create a (global) alias, moving a redefined one to the end
+ */
+int add_alias(char *k, char *v, bool global) {
     int keylength = strnlen(k, MAX_ALIAS_KEY_LENGTH);
     
-    // alloc memory for the new alias struct and its key
-    // note: *val has already been alloced by the resolvealiases() call
-    struct alias *new = malloc(sizeof(struct alias)); //TODO chkerr
-    new->next = NULL;
+    // a redefined alias is moved to the end
+    int slot = find_slot(k, keylength);
+    if (slot >= 0)
+        remove_alias(slot);
+    // keep the load factor (including deleted slots) below 3/4, and compact a half empty array
+    if ((nb_used_slots+1) * 4 > nb_slots * 3 || (nb_entries == max_entries && nb_aliases < nb_entries/2))
+        rebuild_table();
+    if (nb_entries == max_entries) {
+        max_entries = max_entries? 2*max_entries : ALIAS_MIN_SLOTS;
+        aliases = realloc(aliases, sizeof(struct alias) * max_entries);
+    }
+    
+    struct alias *new = &aliases[nb_entries];
     new->key = malloc(sizeof (char) * keylength+1);
+    memcpy(new->key, k, keylength);
+    new->key[keylength] = '\0';
+    new->value = strclone(v);
+    new->hash = hash_key(new->key, keylength);
+    new->global = global;
     
-    // copy the provided strings into the allocated memory
-    strncpy(new->key, k, keylength+1);
-    new->value = val;
+    // the first empty or deleted slot in the probe sequence
+    for (slot = new->hash & (nb_slots-1); slots[slot] >= 0; slot = (slot+1) & (nb_slots-1))
+        ;
+    nb_used_slots += (slots[slot] == SLOT_EMPTY);
+    slots[slot] = nb_entries++;
     
-    if(alias_exists(k)) {
-        unalias(k);
-    }
-	total_alias_val_length += vallength;
-
-    if (head == NULL) {
-	    head = new;
-	    tail = head;
-	}
-	else {
-	    tail->next = new;
-	    tail = new;
-	}
-	nb_aliases++;
-	alias_key_changed = true;
+    nb_aliases++;
+    nb_global_aliases += global;
+    global_keys_changed = global_keys_changed || global;
+    alias_key_changed = true;
     return EXIT_SUCCESS;
 }
 
@@ -83,29 +147,13 @@ int alias(char *k, char *v) {
  *  returns EXIT_SUCCESS if the specified key was found; else prints an error message and returns EXIT_FAILURE 
  */
 int unalias(char *key) {
-    struct alias *cur = head;
-    struct alias *prev = NULL;
-    while (cur != NULL) {
-        if (strncmp(cur->key, key, MAX_ALIAS_KEY_LENGTH) == 0) {
-            // re-organize the linked list
-            if (prev)
-                prev->next = cur->next;
-            else
-                head = cur->next;
-            if (cur == tail)
-                tail = prev;
-            // free the unalised alias and return
-            total_alias_val_length -= strnlen(cur->value, MAX_ALIAS_VAL_LENGTH);
-            free(cur);
-            nb_aliases--;
-            alias_key_changed = true;
-            return EXIT_SUCCESS;;
-        }
-        prev = cur;
-        cur = cur->next;
+    int slot = find_slot(key, strnlen(key, MAX_ALIAS_KEY_LENGTH));
+    if (slot < 0) {
+        printerr("unalias: no such alias key: %s", key);
+        return EXIT_FAILURE;
     }
-    printerr("unalias: no such alias key: %s", key);
-    return EXIT_FAILURE;
+    remove_alias(slot);
+    return EXIT_SUCCESS;
 }
 
 /*
@@ -113,17 +161,16 @@ int unalias(char *key) {
  * returns EXIT_SUCCESS
  */
 int printaliases() {
-    struct alias *cur = head;
-    while(cur != NULL) {
-        printf("alias %s = '%s'\n", cur->key, cur->value);
-        cur = cur->next;
-    }
+    int i;
+    for (i = 0; i < nb_entries; i++)
+        if (aliases[i].key != NULL)
+            printf("alias %s%s = '%s'\n", aliases[i].global? "-g " : "", aliases[i].key, aliases[i].value);
     return EXIT_SUCCESS;
 }
 
 /*
  * get_all_alias_keys: returns a newly malloced array of pointers to newly malloced strings
- *  containing a copy of the alias keys.
+ *  containing a copy of the (non-global) alias keys.
  * @param nb_keys           : if non-NULL; will contain the length of the result array;
  *  nb_keys will be untouched if NULL is returned
  * @param only_on_change    : if true, the result will only be non-NULL if one of the alias
@@ -137,16 +184,13 @@ char **get_all_alias_keys(unsigned int *nb_keys, bool only_on_change) {
         return NULL;
     }
     
-    char **ret = malloc(sizeof(char*) * nb_aliases);
+    char **ret = malloc(sizeof(char*) * (nb_aliases - nb_global_aliases + 1));
 
-    int i = 0;
-    struct alias *cur = head;
-    while(cur != NULL) {
-        ret[i] = strclone(cur->key);
-        cur = cur->next;
-        i++;
-    }
-    if (nb_keys) *nb_keys = nb_aliases;
+    int i, n = 0;
+    for (i = 0; i < nb_entries; i++)
+        if (aliases[i].key != NULL && !aliases[i].global)
+            ret[n++] = strclone(aliases[i].key);
+    if (nb_keys) *nb_keys = n;
     alias_key_changed = false;
     return ret;
 }
@@ -157,76 +201,347 @@ char **get_all_alias_keys(unsigned int *nb_keys, bool only_on_change) {
  *  NOTE: this function returns a pointer to a newly malloced() string. The caller should free() it afterwards, 
  *        as well as also the inputstring *s, if needed
  *
+ *  The line is scanned once: only the words in cmd position (at the start, after '|', ';', '&', '(' or
+ *  'sudo') are looked up in the alias hash table, so the cost doesn't depend on the nb of aliases. An alias
+ *  value is expanded recursively, except for the aliases it is (nested in) the expansion of. A word starting
+ *  with '~' is looked up up to its first '/', in any position. A '\' escaped or quoted word isn't expanded.
+ *  The global aliases are expanded first, see expand_global_aliases().
+ *
  *  current limitations for aliases:
  * TODO - any spaces in the value must be escaped in the input for the 'alias' cmd    e.g. alias ls ls\ --color=auto
  *                                                                                    alt syntax: alias ls "ls --color=auto"
  */
 char *resolvealiases(char *s) {
-    bool is_valid_alias(char*, char*, int); // helper function def
+    int active[MAX_ALIAS_DEPTH];
+    strbuf ret = STRBUF_INIT, global = STRBUF_INIT;
+    strbuf_append(&ret, "", 0);
+    // the keys (re)defined by the 'alias' and 'unalias' cmds aren't expanded
+    const char *first = s + strspn(s, " \t");
+    size_t len = strcspn(first, ALIAS_SEPARATORS);
+    bool is_alias_cmd = (len == 5 && strncmp(first, "alias", 5) == 0) || (len == 7 && strncmp(first, "unalias", 7) == 0);
+    if (nb_global_aliases > 0 && !is_alias_cmd) {
+        expand_global_aliases(s, &global);
+        expand_aliases(global.buf, &ret, active, 0);
+        strbuf_free(&global);
+    }
+    else
+        expand_aliases(s, &ret, active, 0);
+    printdebug("alias: input resolved to: '%s'", ret.buf);
+    return ret.buf;
+}
 
-    // alloc enough space for the return value
-    int maxsize = strlen(s) + total_alias_val_length; 
-    char *ret = malloc(sizeof (char) * maxsize);
-    strcpy(ret, s);
-    
-    // find all alias key substrings, replacing them if valid in context
-    struct alias *cur;
-    char *p, *str; // p is pointer to matched substring; str is pointer to not-yet-checked string
-    for (cur = head; cur != NULL; cur = cur->next)
-        for (str = ret; (p = strstr(str, cur->key)) != NULL;) {
-            if (is_valid_alias(cur->key, ret, p-ret)) {
-                printdebug("alias: '%s' VALID in context '%s'", cur->key, p);
-                
-                char *after = p + strlen(cur->key);
-                memmove(p + strlen(cur->value), after, strlen(after)+1); // overlapping mem; len+1 : also copy the '\0'
-                memcpy(p, cur->value, strlen(cur->value)); // non-overlapping mem
-                str = p+strlen(cur->value);
-                }
-            else {
-                printdebug("alias: '%s' INVALID in context '%s'", cur->key, p);
-                str = p+strlen(cur->key);
-            }
+/*
+ * has_global_aliases: returns whether or not any global alias is defined
+ */
+bool has_global_aliases(void) {
+    return nb_global_aliases > 0;
+}
+
+/*
+ * alias_exists: returns whether or not a specified key is currently aliased.
+ * @return true if the supplied alias already exists; else false.
+ */
+bool alias_exists(char* key) {
+    return find_slot(key, strnlen(key, MAX_ALIAS_KEY_LENGTH)) >= 0;
+}
+
+/*
+ * expand_aliases: append the provided string to the strbuf, with the aliases expanded
+ * @arg active: the indices of the aliases being expanded (not to be expanded again)
+ * @arg depth: the nb of active aliases
+ * @return: whether or not the next word would be in cmd position (e.g. after 'sudo' or '|')
+ */
+bool expand_aliases(const char *s, strbuf *sb, int *active, int depth) {
+    const char *p = s, *end;
+    bool cmd_pos = true;
+    int slot, i;
+    while (*p != '\0') {
+        if (*p == '"' || *p == '\'') {
+            // a quoted string is copied verbatim
+            for (end = p+1; *end != '\0' && *end != *p; end++)
+                if (*p == '"' && *end == '\\' && end[1] != '\0')
+                    end++;
+            end += (*end != '\0');
+            strbuf_append(sb, p, end - p);
+            cmd_pos = false;
+            p = end;
+            continue;
         }
+        if (strchr(ALIAS_SEPARATORS, *p) != NULL) {
+            // note: the '&' of a '>&' redirection isn't a separator
+            if (*p != ' ' && *p != '\t')
+                cmd_pos = strchr(ALIAS_CMD_SEPARATORS, *p) != NULL && !(*p == '&' && p > s && (p[-1] == '>' || p[-1] == '<'));
+            strbuf_append(sb, p++, 1);
+            continue;
+        }
+        
+        end = p + strcspn(p, ALIAS_SEPARATORS "\"'");
+        bool escaped = (*p == '\\');
+        const char *word = p + escaped;
+        size_t len = end - word, keylen = len;
+        if (*word == '~') {
+            // the tilde prefix, in any position
+            const char *slash = memchr(word, '/', len);
+            keylen = slash? slash - word : len;
+        }
+        else if (!cmd_pos)
+            keylen = 0;
+        slot = (keylen > 0)? find_slot(word, keylen) : -1;
+        if (slot >= 0 && aliases[slots[slot]].global)
+            slot = -1;
+        for (i = 0; slot >= 0 && i < depth; i++)
+            if (active[i] == slots[slot])
+                slot = -1;
+        
+        if (slot < 0 || depth == MAX_ALIAS_DEPTH) {
+            strbuf_append(sb, p, end - p);
+            cmd_pos = cmd_pos && (end - p) == 4 && strncmp(p, "sudo", 4) == 0;
+        }
+        else if (escaped) {
+            printdebug("alias: escaping '%.*s'", (int) keylen, word);
+            strbuf_append(sb, word, len);
+            cmd_pos = false;
+        }
+        else if (*word == '~') {
+            strbuf_appends(sb, aliases[slots[slot]].value);
+            strbuf_append(sb, word + keylen, len - keylen);
+            cmd_pos = false;
+        }
+        else {
+            printdebug("alias: expanding '%s'", aliases[slots[slot]].key);
+            active[depth] = slots[slot];
+            cmd_pos = expand_aliases(aliases[slots[slot]].value, sb, active, depth+1);
+        }
+        p = end;
+    }
+    return cmd_pos;
+}
+
+/*
+ * hash_key: returns the FNV-1a hash of the first len chars of the provided key
+ */
+unsigned int hash_key(const char *key, size_t len) {
+    unsigned int hash = 2166136261u;
+    while (len-- > 0) {
+        hash ^= (unsigned char) *key++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/*
+ * find_slot: returns the hash table slot of the key with the provided length (not necessarily
+ *  '\0' terminated), or -1 if it isn't aliased
+ */
+int find_slot(const char *key, size_t len) {
+    if (nb_slots == 0 || len > MAX_ALIAS_KEY_LENGTH)
+        return -1;
+    unsigned int hash = hash_key(key, len);
+    int slot;
+    // the load factor is below 1: the probe sequence ends at an empty slot
+    for (slot = hash & (nb_slots-1); slots[slot] != SLOT_EMPTY; slot = (slot+1) & (nb_slots-1)) {
+        struct alias *a = &aliases[slots[slot]];
+        if (slots[slot] >= 0 && a->hash == hash && strncmp(a->key, key, len) == 0 && a->key[len] == '\0')
+            return slot;
+    }
+    return -1;
+}
+
+/*
+ * remove_alias: unalias the alias in the provided hash table slot, freeing its key and value
+ */
+void remove_alias(int slot) {
+    struct alias *a = &aliases[slots[slot]];
+    free(a->key);
+    free(a->value);
+    a->key = a->value = NULL;
+    slots[slot] = SLOT_DELETED;
+    nb_global_aliases -= a->global;
+    global_keys_changed = global_keys_changed || a->global;
+    // trailing holes can simply be dropped
+    while (nb_entries > 0 && aliases[nb_entries-1].key == NULL)
+        nb_entries--;
+    nb_aliases--;
+    alias_key_changed = true;
+}
+
+/*
+ * rebuild_table: compact the aliases array and rebuild the hash table without deleted slots,
+ *  sized for a load factor of at most 1/4
+ */
+void rebuild_table(void) {
+    int i, n = 0, slot;
+    for (i = 0; i < nb_entries; i++)
+        if (aliases[i].key != NULL) {
+            // the automaton refers to the global aliases by their index
+            global_keys_changed = global_keys_changed || (aliases[i].global && n != i);
+            aliases[n++] = aliases[i];
+        }
+    nb_entries = n;
     
-    printdebug("alias: input resolved to: '%s'", ret);
-    return ret;
+    for (nb_slots = ALIAS_MIN_SLOTS; nb_slots < 4 * (nb_aliases+1); nb_slots *= 2)
+        ;
+    free(slots);
+    slots = malloc(sizeof(int) * nb_slots);
+    for (i = 0; i < nb_slots; i++)
+        slots[i] = SLOT_EMPTY;
+    for (i = 0; i < nb_entries; i++) {
+        for (slot = aliases[i].hash & (nb_slots-1); slots[slot] != SLOT_EMPTY; slot = (slot+1) & (nb_slots-1))
+            ;
+        slots[slot] = i;
+    }
+    nb_used_slots = nb_entries;
 }
 
-/* 
- * is_valid_alias: returns whether or not an occurence of an alias key is valid (i.e. must be 
- *  replaced by its value) in a given context string. An alias match is valid iff it occurs 
- *  as a comd in the grammar and it's not '\' escaped.
- *
- *  @param key: the alias key corresponding to the alias that is matched
- *  @param context: the context string where the alias is matched
- *  @param i: the index in the context string where the alias is matched: context+i equals alias->key
+/*
+ * expand_global_aliases: append the provided string to the strbuf, with the global aliases expanded.
+ *  All keys are found in a single pass of the automaton over the string; overlapping matches are
+ *  resolved leftmost longest. A key is only matched at a word boundary (where its first or last char is
+ *  a word char), outside of quotes. A '\' escaped occurrence isn't expanded, but loses the '\'.
+ *  The values aren't scanned for global aliases again.
  */
-bool is_valid_alias(char *key, char *context, int i) {
-    // allow escaping '\' of aliases TODO is this usefull? --> yes for the ~ alias hack
-    if ( i > 0 && *(context+i-1) == '\\' ) {
-        printdebug("alias: escaping '%s'", key);
-        memmove(context+i-1, context+i, strlen(context+i)+1); //TODO this function shouldn't change the given context
-        return false;
+void expand_global_aliases(const char *s, strbuf *sb) {
+    if (global_keys_changed) {
+        build_automaton();
+        global_keys_changed = false;
     }
+    int n = strlen(s), i, start, len, node, state = 0, last_quoted = -1;
+    int *best = malloc(sizeof(int) * (n+1));     // the node of the longest match starting at i, or -1
+    char quote = '\0';
+    bool escape = false;
+    for (i = 0; i <= n; i++)
+        best[i] = -1;
     
-    // built_in aliases are valid in any context TODO unless escaped...
-    if (*key == '~')
-        return true;
+    for (i = 0; i < n; i++) {
+        if (quote != '\0') {
+            last_quoted = i;
+            if (escape)
+                escape = false;
+            else if (quote == '"' && s[i] == '\\')
+                escape = true;
+            else if (s[i] == quote)
+                quote = '\0';
+        }
+        else if (s[i] == '"' || s[i] == '\'') {
+            quote = s[i];
+            last_quoted = i;
+        }
+        
+        state = ac_goto(state, s[i]);
+        // all keys ending at i, from long to short
+        for (node = (ac_nodes[state].output >= 0)? state : ac_nodes[state].dict; node >= 0; node = ac_nodes[node].dict) {
+            const char *key = aliases[ac_nodes[node].output].key;
+            len = ac_nodes[node].depth;
+            start = i+1 - len;
+            int before = (start > 0 && s[start-1] == '\\')? start-1 : start;
+            if (start <= last_quoted || (is_word_char(key[0]) && before > 0 && is_word_char(s[before-1]))
+                || (is_word_char(key[len-1]) && is_word_char(s[i+1])))
+                continue;
+            if (best[start] < 0 || ac_nodes[best[start]].depth < len)
+                best[start] = node;
+        }
+    }
     
-    return is_valid_cmd(key, context, i);
+    for (i = 0; i < n; ) {
+        if (s[i] == '\\' && best[i+1] >= 0) {
+            len = ac_nodes[best[i+1]].depth;
+            printdebug("alias: escaping '%.*s'", len, s+i+1);
+            strbuf_append(sb, s+i+1, len);
+            i += 1 + len;
+        }
+        else if (best[i] >= 0) {
+            printdebug("alias: expanding global '%s'", aliases[ac_nodes[best[i]].output].key);
+            strbuf_appends(sb, aliases[ac_nodes[best[i]].output].value);
+            i += ac_nodes[best[i]].depth;
+        }
+        else
+            strbuf_append(sb, s + i++, 1);
+    }
+    strbuf_append(sb, "", 0);
+    free(best);
 }
 
 /*
- * alias_exists: returns whether or not a specified key is currently aliased.
- * @return true if the supplied alias already exists; else false.
+ * build_automaton: (re)build the Aho-Corasick automaton of the global alias keys
  */
-bool alias_exists(char* key) {
-	if (!head) return false;
-
-	struct alias *curAlias;
-    for (curAlias = head; curAlias != NULL; curAlias = curAlias->next) {
-		// If the current alias matches the argument, return true.
-		if (strcmp(curAlias->key, key) == 0) return true;
-	}
-	return false;
+void build_automaton(void) {
+    int i, node, child, head = 0, tail = 0;
+    const char *c;
+    nb_ac_nodes = 0;
+    ac_add_node(-1, '\0');
+    for (i = 0; i < nb_entries; i++) {
+        if (aliases[i].key == NULL || !aliases[i].global || aliases[i].key[0] == '\0')
+            continue;
+        for (node = 0, c = aliases[i].key; *c != '\0'; c++) {
+            for (child = ac_nodes[node].child; child >= 0 && ac_nodes[child].c != (unsigned char) *c; child = ac_nodes[child].sibling)
+                ;
+            node = (child >= 0)? child : ac_add_node(node, *c);
+        }
+        ac_nodes[node].output = i;
+    }
+    
+    // breadth first, so the fail links of the shallower nodes are known
+    int *queue = malloc(sizeof(int) * nb_ac_nodes);
+    for (child = ac_nodes[0].child; child >= 0; child = ac_nodes[child].sibling)
+        queue[tail++] = child;
+    while (head < tail) {
+        node = queue[head++];
+        int fail = ac_nodes[node].fail;
+        ac_nodes[node].dict = (ac_nodes[fail].output >= 0)? fail : ac_nodes[fail].dict;
+        for (child = ac_nodes[node].child; child >= 0; child = ac_nodes[child].sibling) {
+            ac_nodes[child].fail = ac_goto(fail, ac_nodes[child].c);
+            queue[tail++] = child;
+        }
+    }
+    free(queue);
+    printdebug("alias: built an automaton of %d nodes for %d global aliases", nb_ac_nodes, nb_global_aliases);
+}
+
+/*
+ * ac_add_node: add a node to the automaton as the first child of the provided parent (or as the
+ *  root if -1), with its fail link to the root; returns its index
+ */
+int ac_add_node(int parent, unsigned char c) {
+    if (nb_ac_nodes == max_ac_nodes) {
+        max_ac_nodes = max_ac_nodes? 2*max_ac_nodes : ALIAS_MIN_SLOTS;
+        ac_nodes = realloc(ac_nodes, sizeof(struct ac_node) * max_ac_nodes);
+    }
+    struct ac_node *new = &ac_nodes[nb_ac_nodes];
+    new->child = -1;
+    new->c = c;
+    new->fail = 0;
+    new->output = new->dict = -1;
+    if (parent >= 0) {
+        new->sibling = ac_nodes[parent].child;
+        new->depth = ac_nodes[parent].depth + 1;
+        ac_nodes[parent].child = nb_ac_nodes;
+    }
+    else {
+        new->sibling = -1;
+        new->depth = 0;
+    }
+    return nb_ac_nodes++;
+}
+
+/*
+ * ac_goto: returns the state of the automaton after reading the provided char in the provided state
+ */
+int ac_goto(int state, unsigned char c) {
+    int child;
+    for (;;) {
+        for (child = ac_nodes[state].child; child >= 0 && ac_nodes[child].c != c; child = ac_nodes[child].sibling)
+            ;
+        if (child >= 0)
+            return child;
+        if (state == 0)
+            return 0;
+        state = ac_nodes[state].fail;
+    }
+}
+
+/*
+ * is_word_char: returns whether or not the provided char is part of a word
+ */
+bool is_word_char(char c) {
+    return c != '\0' && strchr(ALIAS_SEPARATORS "\"'", c) == NULL;
 }
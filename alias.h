@@ -25,9 +25,11 @@
 #include "jsh-parse.h"
 
 int alias(char*, char*);
+int global_alias(char*, char*);
 int unalias(char* key);
 int printaliases();
 char *resolvealiases(char*);
 bool alias_exists(char*);
+bool has_global_aliases(void);
 char **get_all_alias_keys(unsigned int*, bool);
 #endif //ALIAS_H_INCLUDED
@@ -0,0 +1,104 @@
+/* This file is part of jsh.
+ *
+ * jsh: A basic UNIX shell implementation in C
+ * Copyright (C) 2014 Jo Van Bulck <jo.vanbulck@student.kuleuven.be>
+ *
+ * jsh is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * jsh is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with jsh.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * alias-bench.c: times loading n aliases, n lookups, resolving a line and n unaliases, linked
+ *  against alias.o and jsh-common.o only. Usage: alias-bench [n ...] (default: 10000 100000)
+ *  To compare with another version of the alias code, build this file against that alias.c.
+ */
+
+#include "../alias.h"
+#include "../jsh-event.h"
+#include <time.h>
+
+#define RESOLVE_RUNS    1000    // nb of times the line is resolved, to time a single resolvealiases()
+
+// the globals and event loop functions jsh-common.o needs, normally defined in jsh.c and jsh-event.c
+bool DEBUG = false;
+bool COLOR = false;
+bool I_AM_FORK = false;
+bool IS_INTERACTIVE = false;
+bool event_interrupted(void) { return false; }
+bool event_wait_readable(int fd) { return true; }
+
+double elapsed_ms(struct timespec*);
+void bench(int);
+
+int main(int argc, char **argv) {
+    int i;
+    printf("%8s %12s %12s %12s %12s\n", "n", "load", "n lookups", "resolve", "n unaliases");
+    if (argc < 2) {
+        bench(10000);
+        bench(100000);
+    }
+    for (i = 1; i < argc; i++)
+        bench(atoi(argv[i]));
+    return EXIT_SUCCESS;
+}
+
+/*
+ * bench: time the alias operations for n aliases k<i> with values v<i> and print a table row
+ */
+void bench(int n) {
+    struct timespec start;
+    char key[32], value[32];
+    int i, found = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < n; i++) {
+        snprintf(key, sizeof(key), "k%d", i);
+        snprintf(value, sizeof(value), "v%d", i);
+        alias(key, value);
+    }
+    double load = elapsed_ms(&start);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < n; i++) {
+        snprintf(key, sizeof(key), "k%d", (int) ((i * 7919L) % n));
+        found += alias_exists(key);
+    }
+    double lookups = elapsed_ms(&start);
+
+    char line[64];
+    snprintf(line, sizeof(line), "k0 foo | k%d bar > k1", n-1);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < RESOLVE_RUNS; i++)
+        free(resolvealiases(line));
+    double resolve = elapsed_ms(&start) / RESOLVE_RUNS;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < n; i++) {
+        snprintf(key, sizeof(key), "k%d", i);
+        unalias(key);
+    }
+    double unaliases = elapsed_ms(&start);
+
+    if (found != n)
+        fprintf(stderr, "alias-bench: only %d of %d aliases found\n", found, n);
+    printf("%8d %10.1fms %10.1fms %10.3fms %10.1fms\n", n, load, lookups, resolve, unaliases);
+}
+
+/*
+ * elapsed_ms: returns the nb of milliseconds since the provided CLOCK_MONOTONIC timestamp
+ */
+double elapsed_ms(struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1000.0 + (now.tv_nsec - start->tv_nsec) / 1e6;
+}
@@ -0,0 +1,46 @@
+#!/bin/bash
+# =============================================================
+# This file is part of jsh.
+# 
+# jsh: A basic UNIX shell implementation in C
+# Copyright (C) 2014 Jo Van Bulck <jo.vanbulck@student.kuleuven.be>
+#
+# jsh is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# jsh is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with jsh.  If not, see <http://www.gnu.org/licenses/>.
+# ============================================================
+
+# launch-bench.sh: times the launch of N (default 2000) /bin/true cmds from a script read on stdin,
+#  with fork() and with the zygote (jsh --zygote), for an empty history and for one of HIST (default
+#  400000) entries: the heap readline keeps for it makes each fork() of the shell more expensive.
+#  Usage: [JSH=./jsh] [N=2000] [HIST=400000] bench/launch-bench.sh
+
+JSH=$(realpath "${JSH:-./jsh}")
+N=${N:-2000}
+HIST=${HIST:-400000}
+TIMEFORMAT="%R %S"
+
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+awk -v n="$N" 'BEGIN { for (i = 0; i < n; i++) print "/bin/true" }' > "$dir/script"
+
+printf "%-8s %-8s %10s %10s\n" "history" "launch" "wall (s)" "sys (s)"
+for hist in 0 "$HIST"; do
+    for mode in fork zygote; do
+        # note: rewritten each run, as jsh appends to it at exit
+        awk -v n="$hist" 'BEGIN { for (i = 0; i < n; i++) printf "echo history entry %d\n", i }' > "$dir/.jsh_history"
+        opt=$([ "$mode" = zygote ] && echo --zygote)
+        # note: the sys time is that of jsh and the children it reaped, i.e. not of the zygote's children
+        t=$( { time HOME="$dir" "$JSH" --nodebug --norc $opt < "$dir/script" > /dev/null 2>&1; } 2>&1 )
+        printf "%-8s %-8s %10s %10s\n" "$hist" "$mode" $t
+    done
+done
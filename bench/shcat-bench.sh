@@ -0,0 +1,51 @@
+#!/bin/bash
+# =============================================================
+# This file is part of jsh.
+# 
+# jsh: A basic UNIX shell implementation in C
+# Copyright (C) 2014 Jo Van Bulck <jo.vanbulck@student.kuleuven.be>
+#
+# jsh is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# jsh is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with jsh.  If not, see <http://www.gnu.org/licenses/>.
+# ============================================================
+
+# shcat-bench.sh: compares the throughput of /bin/cat and the shcat built-in on a SIZE MB (default
+#  1024) file, hot in the page cache: file -> file, file -> pipe and pipe -> pipe. Both run from jsh,
+#  so the shell startup is included for both.
+#  Usage: [JSH=./jsh] [SIZE=1024] [DIR=/tmp] bench/shcat-bench.sh
+
+JSH=$(realpath "${JSH:-./jsh}")
+SIZE=${SIZE:-1024}
+
+dir=$(mktemp -d "${DIR:-/tmp}/shcat-bench.XXXXXX")
+trap 'rm -rf "$dir"' EXIT
+head -c $((SIZE * 1024 * 1024)) /dev/urandom > "$dir/in"
+cat "$dir/in" > /dev/null
+
+# mb_per_s cmdline: runs the cmdline in jsh and prints the throughput in MB/s
+mb_per_s() {
+    local start end
+    start=$(date +%s%N)
+    echo "$1" | "$JSH" --nodebug --norc > /dev/null
+    end=$(date +%s%N)
+    echo $((SIZE * 1000000000 / (end - start)))
+}
+
+printf "%-14s %10s %10s\n" "" "/bin/cat" "shcat"
+printf "%-14s %10s %10s\n" "file -> file" "$(mb_per_s "/bin/cat $dir/in > $dir/out") MB/s" \
+    "$(mb_per_s "shcat $dir/in > $dir/out") MB/s"
+printf "%-14s %10s %10s\n" "file -> pipe" "$(mb_per_s "/bin/cat $dir/in | wc -c") MB/s" \
+    "$(mb_per_s "shcat $dir/in | wc -c") MB/s"
+printf "%-14s %10s %10s\n" "pipe -> pipe" "$(mb_per_s "/bin/cat $dir/in | /bin/cat | wc -c") MB/s" \
+    "$(mb_per_s "/bin/cat $dir/in | shcat | wc -c") MB/s"
+cmp -s "$dir/in" "$dir/out" || echo "shcat-bench: the output of shcat differs from its input" >&2
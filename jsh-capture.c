@@ -0,0 +1,208 @@
+/* This file is part of jsh.
+ *
+ * jsh: A basic UNIX shell implementation in C
+ * Copyright (C) 2014 Jo Van Bulck <jo.vanbulck@student.kuleuven.be>
+ *
+ * jsh is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * jsh is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with jsh.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * jsh-capture.c: opt-in capture of the output of the last command. The last stage of a
+ *  pipeline writes to a pipe; jsh passes the data through to its own stdout, keeping the
+ *  last bytes in a bounded ring buffer that the replay built_in can write into a new pipeline.
+ */
+
+#define _GNU_SOURCE     // tee() and splice()
+#include "jsh-capture.h"
+#include "jsh-event.h"
+#include "jsh-wait.h"
+#include <poll.h>
+
+#define CAPTURE_CHUNK   65536   // max nb of bytes passed through per tee() / read() call
+#define CAPTURE_POLL_MS 10      // polling interval for the termination of a last cmd without a pidfd
+
+// #################### helper function definitions ####################
+ssize_t ring_read(int, size_t, size_t*);
+bool output_ready(int, int, pid_t);
+bool has_exited(pid_t);
+void forward_output(int, void*);
+
+bool CAPTURE = false;
+
+static char *ring = NULL;       // the capture ring buffer
+static size_t ring_size = 0;    // allocated size of the ring buffer
+static size_t ring_pos = 0;     // index in the ring where the next captured byte goes
+static size_t ring_len = 0;     // nb of captured bytes, ending just before ring_pos
+
+int capture_set(size_t size) {
+    free(ring);
+    ring = NULL;
+    ring_size = ring_pos = ring_len = 0;
+    CAPTURE = false;
+    if (size == 0)
+        return EXIT_SUCCESS;
+    if ((ring = malloc(size)) == NULL) {
+        printerrno("capture: couldn't allocate a buffer of %zu bytes", size);
+        return EXIT_FAILURE;
+    }
+    ring_size = size;
+    CAPTURE = true;
+    return EXIT_SUCCESS;
+}
+
+int capture_pump(int fd, pid_t last) {
+    ssize_t n, m;
+    size_t at;
+    int rv = EXIT_SUCCESS, pidfd = (last > 0)? open_pidfd(last) : -1;
+    bool eof = false, last_done = false, passthrough = true;
+    ring_pos = ring_len = 0;
+
+    #ifdef SPLICE_F_MOVE
+    int copy[2], err = 0;
+    ssize_t moved, kept;
+    if (pipe(copy) == 0) {
+        // duplicate the data in the copy pipe, move the original to stdout and keep the copy
+        while (!(last_done = !output_ready(fd, pidfd, last))) {
+            if ((n = tee(fd, copy[1], CAPTURE_CHUNK, 0)) < 0 && errno == EINTR)
+                continue;
+            if ((eof = (n == 0)) || n < 0)
+                break;
+            for (moved = 0; moved < n; moved += m)
+                if ((m = splice(fd, NULL, STDOUT_FILENO, NULL, n - moved, SPLICE_F_MOVE)) <= 0) {
+                    err = (m < 0)? errno : EIO;
+                    break;
+                }
+            // keep the copy of what was moved to stdout; the rest is still in fd
+            for (kept = 0; kept < moved; kept += m)
+                if ((m = ring_read(copy[0], moved - kept, &at)) <= 0)
+                    break;
+            if (moved < n) {
+                // stdout has no splice support (EINVAL): fall back to read() below; else it failed
+                if (err != EINVAL) {
+                    errno = err;
+                    printerrno("capture: writing the output of the last command failed; only capturing it");
+                    passthrough = false;
+                }
+                break;
+            }
+        }
+        close(copy[0]);
+        close(copy[1]);
+    }
+    #endif
+
+    // read the data in the ring buffer and write it to stdout from there
+    while (!eof && !last_done && !(last_done = !output_ready(fd, pidfd, last))) {
+        if ((n = ring_read(fd, CAPTURE_CHUNK, &at)) < 0) {
+            printerrno("capture: reading the output of the last command failed");
+            rv = EXIT_FAILURE;
+            break;
+        }
+        if ((eof = (n == 0)))
+            break;
+        if (passthrough && write_full(STDOUT_FILENO, ring + at, n) != EXIT_SUCCESS) {
+            printerrno("capture: writing the output of the last command failed; only capturing it");
+            passthrough = false;
+        }
+    }
+    
+    if (pidfd != -1)
+        close(pidfd);
+    // a process forked by the last cmd (e.g. a daemon) may still write to the pipe: keep passing
+    //  its output through from the event loop, without capturing it
+    if (!eof && rv == EXIT_SUCCESS && event_add_fd(fd, forward_output, NULL) == EXIT_SUCCESS)
+        printdebug("capture: forwarding the output of the background processes of the last cmd");
+    else
+        close(fd);
+    return rv;
+}
+
+int capture_replay(int fd) {
+    if (ring_len == 0)
+        return EXIT_SUCCESS;
+    size_t start = (ring_pos + ring_size - ring_len) % ring_size;
+    size_t first = (ring_len < ring_size - start)? ring_len : ring_size - start;
+    if (write_full(fd, ring + start, first) != EXIT_SUCCESS ||
+        write_full(fd, ring, ring_len - first) != EXIT_SUCCESS) {
+        printerrno("replay: couldn't write the captured output");
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+// #################### helper functions ####################
+
+/*
+ * output_ready: wait until fd is readable (or at EOF) or the last cmd has terminated
+ * @arg pidfd: a pidfd of the last cmd, or -1 to poll for its termination with has_exited()
+ * @return: true iff fd is ready; false iff the last cmd terminated and there is no data left
+ *  (that was written by the last cmd itself)
+ */
+bool output_ready(int fd, int pidfd, pid_t last) {
+    // note: the children watched by the event loop (e.g. queued tasks) are serviced meanwhile
+    struct pollfd pfds[3] = {{fd, POLLIN, 0}, {pidfd, POLLIN, 0}, {event_children_fd(), POLLIN, 0}};
+    int n, timeout = (pidfd == -1 && last > 0)? CAPTURE_POLL_MS : -1;
+    for (;;) {
+        if ((n = poll(pfds, 3, timeout)) < 0 && errno == EINTR)
+            continue;
+        if (n < 0 || pfds[0].revents)
+            return true;    // let the read report the data, EOF or error
+        if (pfds[2].revents)
+            event_reap_children();
+        if ((pidfd != -1 && pfds[1].revents) || (pidfd == -1 && last > 0 && has_exited(last)))
+            // whatever the last cmd wrote is in the pipe by now
+            return poll(pfds, 1, 0) > 0;
+    }
+}
+
+/*
+ * has_exited: returns whether or not the provided child has terminated, without reaping it
+ */
+bool has_exited(pid_t pid) {
+    siginfo_t info;
+    info.si_pid = 0;
+    return waitid(P_PID, pid, &info, WEXITED | WNOHANG | WNOWAIT) == 0 && info.si_pid == pid;
+}
+
+/*
+ * forward_output: event loop callback passing the output that is left in the capture pipe
+ *  through to stdout, until EOF
+ */
+void forward_output(int fd, void *arg) {
+    (void) arg;
+    char buf[CAPTURE_CHUNK];
+    ssize_t n;
+    while ((n = read(fd, buf, sizeof(buf))) < 0 && errno == EINTR);
+    if (n > 0 && write_full(STDOUT_FILENO, buf, n) == EXIT_SUCCESS)
+        return;
+    event_remove_fd(fd);
+    close(fd);
+}
+
+/*
+ * ring_read: read at most n bytes from fd into the ring buffer, overwriting the oldest bytes
+ * @arg at: set to the index in the ring where the bytes read were stored
+ * @return: the nb of bytes read, 0 on EOF or -1 on error
+ */
+ssize_t ring_read(int fd, size_t n, size_t *at) {
+    size_t room = ring_size - ring_pos;     // note: don't wrap around within a single read
+    ssize_t rv;
+    while ((rv = read(fd, ring + ring_pos, (n < room)? n : room)) < 0 && errno == EINTR);
+    if (rv > 0) {
+        *at = ring_pos;
+        ring_pos = (ring_pos + rv) % ring_size;
+        ring_len = (ring_len + rv < ring_size)? ring_len + rv : ring_size;
+    }
+    return rv;
+}
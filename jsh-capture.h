@@ -0,0 +1,53 @@
+/* This file is part of jsh.
+ *
+ * jsh: A basic UNIX shell implementation in C
+ * Copyright (C) 2014 Jo Van Bulck <jo.vanbulck@student.kuleuven.be>
+ *
+ * jsh is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * jsh is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with jsh.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CAPTURE_H_INCLUDED
+#define CAPTURE_H_INCLUDED
+/* ^^ these are the include guards */
+
+#include "jsh-common.h"
+
+#define CAPTURE_DEFAULT_MIB     4   // default size of the capture buffer, in MiB
+
+extern bool CAPTURE;        // whether or not the output of the last command is captured
+
+/*
+ * capture_set: (re)allocate the capture ring buffer with the provided size, discarding its
+ *  content; a size of 0 turns capture mode off and frees the buffer
+ * @return: EXIT_SUCCESS or EXIT_FAILURE if the buffer couldn't be allocated
+ */
+int capture_set(size_t);
+
+/*
+ * capture_pump: pass everything read from fd through to stdout until EOF, or until the process
+ *  last (if > 0) terminated and the pipe is empty, keeping the last bytes in the (emptied)
+ *  capture ring buffer. On Linux, when stdout is a pipe or a regular file, the passthrough is
+ *  done with tee() and splice(), without copying to user space. Takes ownership of fd: if it
+ *  is still open, e.g. by a daemon forked by last, the event loop passes the rest through.
+ * @return: EXIT_SUCCESS or EXIT_FAILURE on a read error
+ */
+int capture_pump(int, pid_t);
+
+/*
+ * capture_replay: write the content of the capture ring buffer to fd
+ * @return: EXIT_SUCCESS or EXIT_FAILURE
+ */
+int capture_replay(int);
+
+#endif //CAPTURE_H_INCLUDED
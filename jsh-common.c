@@ -17,7 +17,21 @@
  * along with jsh.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#define _GNU_SOURCE     // copy_file_range(), splice() and memfd_create()
 #include "jsh-common.h"
+#include "jsh-event.h"
+#include <time.h>
+#include <math.h>
+#ifdef __linux__
+    #include <sys/sendfile.h>
+    #include <sys/mman.h>
+#endif
+
+#define COPY_CHUNK          (4 << 20)   // max nb of bytes per copy_file_range() / sendfile() / splice() call
+#define COPY_BUF_LENGTH     (128 << 10) // buffer size for the read() / write() fallback of copy_fd()
+
+// #################### helper function definitions ####################
+void strbuf_grow(strbuf*, size_t);
 
 #define SET_ERR_COLOR \
     if (IS_INTERACTIVE && COLOR) \
@@ -131,6 +145,10 @@ void parsestream(FILE *strm, char* name, void (*fct)(char*)) {
     
     while ((c = fgetc(strm)) != EOF)
          if (c == '\n') {
+            if (event_interrupted()) {
+                printerr("%s: interrupted at line %d", name, j);
+                break;
+            }
             line[i] = '\0';
             printdebug("%s: now parsing line %d: '%s'", name, j, line);
             fct(line);
@@ -149,6 +167,19 @@ void parsestream(FILE *strm, char* name, void (*fct)(char*)) {
     printdebug("-------- end of stream '%s' --------", name);    
 }
 
+/*
+ * exit_fork: exit() with the provided status, but in a fork, only flush stdout and stderr and
+ *  _exit(): syncing the inherited stdio input streams would move the file offset they share
+ *  with the parent back, e.g. making it parse the rest of a script file a second time
+ */
+void exit_fork(int status) {
+    if (!I_AM_FORK)
+        exit(status);
+    fflush(stdout);
+    fflush(stderr);
+    _exit(status);
+}
+
 /*
  * string_cmp: wrapper function for strcmp(); to be passed to bsearch() or qsort() in order to compare
  *  two pointers to a string (char**)
@@ -216,6 +247,61 @@ char* concat(int count, ...) {
     return merged;
 }
 
+/*
+ * now_ms: returns a monotonic timestamp in milliseconds, to measure durations and deadlines
+ */
+long long now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+/*
+ * parse_duration: parses a duration string: a (floating point) number with an optional
+ *  unit suffix 's' (seconds, the default), 'ms', 'm' (minutes), 'h' (hours) or 'd' (days).
+ * @return: the duration in milliseconds, DURATION_INFINITE for "inf" or a duration that doesn't
+ *  fit in a long, or -1 if the string isn't a valid duration
+ */
+long parse_duration(const char *str) {
+    char *end;
+    double d = strtod(str, &end);
+    if (end == str || isnan(d) || d < 0)
+        return -1;
+    if (*end == '\0' || strcmp(end, "s") == 0)
+        d *= 1000;
+    else if (strcmp(end, "m") == 0)
+        d *= 60 * 1000;
+    else if (strcmp(end, "h") == 0)
+        d *= 60 * 60 * 1000;
+    else if (strcmp(end, "d") == 0)
+        d *= 24 * 60 * 60 * 1000;
+    else if (strcmp(end, "ms") != 0)
+        return -1;
+    // note: casting a double that doesn't fit in a long is undefined behaviour
+    return (d >= (double) LONG_MAX)? DURATION_INFINITE : (long) d;
+}
+
+/*
+ * online_cpus: returns the nb of online CPUs (at least 1): the default nb of jobs to run in parallel
+ */
+int online_cpus(void) {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return (n > 0)? n : 1;
+}
+
+/*
+ * parse_jobs: parses the nb of jobs to run in parallel, as passed to e.g. -j: a number >= 0,
+ *  where 0 stands for the nb of online CPUs
+ * @return: the nb of jobs (at least 1), or -1 if the string isn't a valid nb of jobs
+ */
+int parse_jobs(const char *str) {
+    char *end;
+    long n = strtol(str, &end, 10);
+    if (end == str || *end != '\0' || n < 0 || n > INT_MAX)
+        return -1;
+    return n? n : online_cpus();
+}
+
 /*
  * remove_char: helper function: deletes all occurences of a specified char in a given '\0' terminated string.
  *  returns the resuling '\0' terminated string
@@ -229,3 +315,307 @@ void remove_char(char *str, char garbage) {
     }
     *dst = '\0';
 }
+
+/*
+ * write_full: write exactly len bytes from buf to fd, restarting on interrupts
+ * @return: EXIT_SUCCESS or EXIT_FAILURE on error
+ */
+int write_full(int fd, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            return EXIT_FAILURE;
+        buf += n;
+        len -= n;
+    }
+    return EXIT_SUCCESS;
+}
+
+/*
+ * copy_fd: copy everything from fd in to fd out, until EOF or ^C, without copying the data
+ *  to user space where the kernel allows it: copy_file_range() for file -> file, sendfile()
+ *  for file -> anything and splice() if one of both is a pipe. Each of these falls back to the
+ *  next (e.g. for a terminal or an O_APPEND file), and finally to a read() / write() loop.
+ * @return: EXIT_SUCCESS or EXIT_FAILURE on error (errno is set)
+ */
+int copy_fd(int in, int out) {
+    ssize_t n = -1;
+    struct stat sin, sout;
+    if (fstat(in, &sin) < 0 || fstat(out, &sout) < 0)
+        return EXIT_FAILURE;
+    // a read from a pipe or terminal can block: wait for data or ^C first
+    bool can_block = !S_ISREG(sin.st_mode);
+    #define READ_READY(fd) (can_block? event_wait_readable(fd) : !event_interrupted())
+    
+    #ifdef __linux__
+        // note: on EOF or ^C, copy_fd() returns; on an error, falls through to the next method
+        #define COPY_LOOP(call) \
+            do { \
+                while ((n = READ_READY(in)? (call) : 0) > 0 || (n < 0 && errno == EINTR)) \
+                    ; \
+                if (n == 0) \
+                    return EXIT_SUCCESS; \
+            } while (0)
+        
+        if (S_ISREG(sin.st_mode) && S_ISREG(sout.st_mode))
+            COPY_LOOP(copy_file_range(in, NULL, out, NULL, COPY_CHUNK, 0));
+        if (S_ISREG(sin.st_mode))
+            COPY_LOOP(sendfile(out, in, NULL, COPY_CHUNK));
+        if (S_ISFIFO(sin.st_mode) || S_ISFIFO(sout.st_mode))
+            COPY_LOOP(splice(in, NULL, out, NULL, COPY_CHUNK, SPLICE_F_MOVE));
+    #endif
+    
+    int rv = EXIT_SUCCESS;
+    char *buf = malloc(COPY_BUF_LENGTH);
+    while (READ_READY(in)) {
+        if ((n = read(in, buf, COPY_BUF_LENGTH)) < 0 && errno == EINTR)
+            continue;
+        if (n <= 0 || write_full(out, buf, n) != EXIT_SUCCESS) {
+            rv = (n == 0)? EXIT_SUCCESS : EXIT_FAILURE;
+            break;
+        }
+    }
+    free(buf);
+    return rv;
+}
+
+/*
+ * can_splice_to: returns whether or not splice() can write to fd: a pipe, a terminal or a
+ *  regular file that isn't opened in append mode
+ */
+bool can_splice_to(int fd) {
+    struct stat st;
+    if (fstat(fd, &st) < 0)
+        return false;
+    return S_ISFIFO(st.st_mode) || isatty(fd) || (S_ISREG(st.st_mode) && !(fcntl(fd, F_GETFL) & O_APPEND));
+}
+
+/*
+ * tee_fd: copy everything from fd in to all nouts fds in outs, until EOF or ^C. If in is a
+ *  pipe and all outputs accept splice(), the data is duplicated with tee() into a private pipe
+ *  per output and spliced from there, so it never crosses into user space; the last output
+ *  gets the original data, spliced from in. Else falls back to a read() / write() loop.
+ * @return: EXIT_SUCCESS or EXIT_FAILURE on error (errno is set)
+ */
+int tee_fd(int in, int *outs, int nouts) {
+    int i, rv = EXIT_SUCCESS;
+    ssize_t n, m, done;
+    struct stat st;
+    if (nouts == 1)
+        return copy_fd(in, outs[0]);
+    if (fstat(in, &st) < 0)
+        return EXIT_FAILURE;
+    bool can_block = !S_ISREG(st.st_mode), zero_copy = (nouts > 0 && S_ISFIFO(st.st_mode));
+    for (i = 0; i < nouts; i++)
+        zero_copy = zero_copy && can_splice_to(outs[i]);
+    
+    #ifdef __linux__
+    if (zero_copy) {
+        int priv[2*(nouts-1)];
+        for (i = 0; i < nouts-1; i++)
+            if (pipe(priv + 2*i) < 0) {
+                while (--i >= 0) {
+                    close(priv[2*i]);
+                    close(priv[2*i+1]);
+                }
+                return EXIT_FAILURE;
+            }
+        #define SPLICE_ALL(from, to) \
+            for (done = 0; done < n; done += m) \
+                if ((m = splice(from, NULL, to, NULL, n - done, SPLICE_F_MOVE)) <= 0) { \
+                    rv = EXIT_FAILURE; \
+                    goto out; \
+                }
+        
+        // note: the private pipes are empty at each iteration, so each tee() duplicates all n bytes
+        while (READ_READY(in)) {
+            if ((n = tee(in, priv[1], COPY_CHUNK, 0)) < 0 && errno == EINTR)
+                continue;
+            if (n <= 0) {
+                rv = (n == 0)? EXIT_SUCCESS : EXIT_FAILURE;
+                break;
+            }
+            for (i = 1; i < nouts-1; i++)
+                if (tee(in, priv[2*i+1], n, 0) != n) {
+                    rv = EXIT_FAILURE;
+                    goto out;
+                }
+            for (i = 0; i < nouts-1; i++)
+                SPLICE_ALL(priv[2*i], outs[i])
+            SPLICE_ALL(in, outs[nouts-1])
+        }
+    out:
+        for (i = 0; i < 2*(nouts-1); i++)
+            close(priv[i]);
+        return rv;
+    }
+    #endif
+    
+    char *buf = malloc(COPY_BUF_LENGTH);
+    while (READ_READY(in)) {
+        if ((n = read(in, buf, COPY_BUF_LENGTH)) < 0 && errno == EINTR)
+            continue;
+        if (n <= 0) {
+            rv = (n == 0)? EXIT_SUCCESS : EXIT_FAILURE;
+            break;
+        }
+        for (i = 0; i < nouts && rv == EXIT_SUCCESS; i++)
+            rv = write_full(outs[i], buf, n);
+        if (rv != EXIT_SUCCESS)
+            break;
+    }
+    free(buf);
+    return rv;
+}
+
+/*
+ * memory_file: returns a file descriptor for a new anonymous, seekable in-memory file
+ *  (memfd_create() on Linux, else an unlinked temporary file), or -1 on failure
+ */
+int memory_file(void) {
+    int fd;
+    #ifdef MFD_CLOEXEC
+        fd = memfd_create("jsh-buffer", MFD_CLOEXEC);
+    #else
+        char path[] = "/tmp/jsh-buffer-XXXXXX";
+        if ((fd = mkstemp(path)) != -1) {
+            unlink(path);
+            fcntl(fd, F_SETFD, FD_CLOEXEC);
+        }
+    #endif
+    return fd;
+}
+
+/*
+ * buffer_fd: returns a file descriptor from which the provided buffer can be read, or -1 on
+ *  failure. A buffer that fits in an empty pipe is written into a pipe, so the writer never
+ *  blocks; a larger one into a memory_file(), positioned at its start, so the reader can also
+ *  seek or mmap() it.
+ */
+int buffer_fd(const char *buf, size_t len) {
+    int fd, pfds[2];
+    if (pipe(pfds) == 0) {
+        #ifdef F_GETPIPE_SZ
+            long capacity = fcntl(pfds[1], F_GETPIPE_SZ);
+        #else
+            long capacity = PIPE_BUF;
+        #endif
+        if (len <= capacity && write_full(pfds[1], buf, len) == EXIT_SUCCESS) {
+            close(pfds[1]);
+            return pfds[0];
+        }
+        close(pfds[0]);
+        close(pfds[1]);
+    }
+    
+    if ((fd = memory_file()) == -1)
+        return -1;
+    if (write_full(fd, buf, len) != EXIT_SUCCESS || lseek(fd, 0, SEEK_SET) == -1) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/*
+ * read_fd: reads the provided file descriptor up to EOF, or ^C if it isn't a regular file
+ * @arg len: if non-NULL, filled in with the nb of bytes read
+ * @return: a malloc()ed, '\0' terminated buffer with the content, or NULL on failure
+ *  (errno is EINTR after a ^C)
+ */
+char *read_fd(int fd, size_t *len) {
+    size_t size = COPY_BUF_LENGTH, n = 0;
+    char *buf = malloc(size + 1);
+    ssize_t rv;
+    struct stat st;
+    // note: regular files are read by the prompt's worker thread too, which mustn't consume a ^C
+    bool can_block = (fstat(fd, &st) == 0 && !S_ISREG(st.st_mode));
+    while (buf) {
+        if (can_block && !event_wait_readable(fd)) {
+            free(buf);
+            errno = EINTR;
+            return NULL;
+        }
+        if ((rv = read(fd, buf + n, size - n)) == 0)
+            break;
+        if (rv < 0 && errno == EINTR)
+            continue;
+        if (rv < 0) {
+            free(buf);
+            return NULL;
+        }
+        if ((n += rv) == size)
+            buf = realloc(buf, (size *= 2) + 1);
+    }
+    if (buf) {
+        buf[n] = '\0';
+        if (len)
+            *len = n;
+    }
+    return buf;
+}
+
+/*
+ * strbuf_grow: make sure the strbuf has room for len more chars and a terminating '\0',
+ *  at least doubling its size when it grows
+ */
+void strbuf_grow(strbuf *sb, size_t len) {
+    if (sb->len + len + 1 <= sb->size)
+        return;
+    sb->size = (sb->len + len + 1 > 2*sb->size)? sb->len + len + 1 : 2*sb->size;
+    sb->buf = realloc(sb->buf, sb->size);
+}
+
+/*
+ * strbuf_append: append the first len chars of the provided string to the strbuf
+ */
+void strbuf_append(strbuf *sb, const char *str, size_t len) {
+    strbuf_grow(sb, len);
+    memcpy(sb->buf + sb->len, str, len);
+    sb->len += len;
+    sb->buf[sb->len] = '\0';
+}
+
+/*
+ * strbuf_appends: append the provided '\0' terminated string to the strbuf
+ */
+void strbuf_appends(strbuf *sb, const char *str) {
+    strbuf_append(sb, str, strlen(str));
+}
+
+/*
+ * strbuf_appendf: append the printf() formatted string to the strbuf
+ */
+void strbuf_appendf(strbuf *sb, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    int len = vsnprintf(NULL, 0, format, args);
+    va_end(args);
+    if (len < 0)
+        return;
+    strbuf_grow(sb, len);
+    va_start(args, format);
+    vsnprintf(sb->buf + sb->len, len + 1, format, args);
+    va_end(args);
+    sb->len += len;
+}
+
+/*
+ * strbuf_reset: empty the strbuf, keeping its allocated memory for reuse
+ */
+void strbuf_reset(strbuf *sb) {
+    sb->len = 0;
+    if (sb->buf)
+        *sb->buf = '\0';
+}
+
+/*
+ * strbuf_free: free the memory of the strbuf and reinitialize it
+ */
+void strbuf_free(strbuf *sb) {
+    free(sb->buf);
+    sb->buf = NULL;
+    sb->len = sb->size = 0;
+}
@@ -38,11 +38,12 @@
 // ########## common macro definitions #########
 #define ASSERT                  true    // whether or not to include the assert statements in the pre-compilation phase
 #define MAX_FILE_LINE_LENGTH    200     // the max nb of chars per line in a file to parse
+#define DURATION_INFINITE       LONG_MAX // parse_duration() of "inf", or of any longer duration
 
 #define REDIRECT_STR(fd1, fd2) \
     if (dup2(fd1, fd2) < 0) { \
         printerrno("Redirecting stream %d to %d failed", fd2, fd1); \
-        exit(EXIT_FAILURE); \
+        exit_fork(EXIT_FAILURE); \
     }
 
 #define CHK_ERR(cond, cmd) \
@@ -68,6 +69,18 @@ static inline int puts_verbatim(const char *s) {
     return fputs(s, stdout);
 }
 
+/*
+ * A growable '\0' terminated string buffer; initialize with STRBUF_INIT and release with
+ *  strbuf_free(). The strbuf_* functions keep buf '\0' terminated once anything was appended.
+ */
+struct strbuf {
+    char *buf;          // the string, or NULL if nothing was appended yet
+    size_t len;         // the length of the string, without the terminating '\0'
+    size_t size;        // the allocated size of buf
+};
+typedef struct strbuf strbuf;
+#define STRBUF_INIT {NULL, 0, 0}
+
 // ######### linux tty color codes ########
 #define RESET		        0
 #define BRIGHT 		        1
@@ -93,7 +106,6 @@ extern bool DEBUG;
 extern bool COLOR;
 extern bool I_AM_FORK;               // whether or not the current process is a fork, i.e. child process
 extern bool IS_INTERACTIVE;
-extern bool WAITING_FOR_CHILD;
 
 // common function definitions
 void printerr(const char*, ...);
@@ -104,12 +116,30 @@ void textcolor(FILE*, int, int);
 
 void parsefile(char*, void (*f)(char*), bool);
 void parsestream(FILE*, char*, void (*f)(char*));
+void exit_fork(int);
 
 int string_cmp(const void*, const void*);
 bool is_sorted(void*, size_t, size_t, int (*compar)(const void *, const void *));
 char *gethome();
 char *strclone(const char*);
 char* concat(int, ...);
+void remove_char(char*, char);
+long long now_ms(void);
+long parse_duration(const char*);
+int online_cpus(void);
+int parse_jobs(const char*);
+int write_full(int, const char*, size_t);
+int copy_fd(int, int);
+bool can_splice_to(int);
+int tee_fd(int, int*, int);
+int memory_file(void);
+int buffer_fd(const char*, size_t);
+char *read_fd(int, size_t*);
+void strbuf_append(strbuf*, const char*, size_t);
+void strbuf_appends(strbuf*, const char*);
+void strbuf_appendf(strbuf*, const char*, ...);
+void strbuf_reset(strbuf*);
+void strbuf_free(strbuf*);
 // TODO malloc wrapper -- gracious
 
 #endif //JSH_COMMON_H_INCLUDED
@@ -225,7 +225,7 @@ char *make_options_generator(const char *text, int state) {
  */
 char *jsh_options_generator(const char *text, int state) {
     static const char *options[] = {"--nodebug", "--debug", "--color", "--nocolor", \
-    "--norc", "--license", "--version", "--help"}; //TODO dont hardcode here --> put enum in jsh.c?
+    "--norc", "--license", "--version", "--help", "--zygote", "--jobs"}; //TODO dont hardcode here --> put enum in jsh.c?
     static const int nb_options = (sizeof(options)/sizeof(options[0]));
     
     COMPLETION_SKELETON(options, nb_options);
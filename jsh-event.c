@@ -0,0 +1,422 @@
+/* This file is part of jsh.
+ *
+ * jsh: A basic UNIX shell implementation in C
+ * Copyright (C) 2014 Jo Van Bulck <jo.vanbulck@student.kuleuven.be>
+ *
+ * jsh is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * jsh is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with jsh.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * jsh-event.c: the jsh event loop. Signals are never handled asynchronously: on Linux,
+ *  SIGINT, SIGCHLD and SIGWINCH are blocked and read from a signalfd; elsewhere the signal
+ *  handler only writes the signal nb to a self-pipe. Either way, signals are dispatched
+ *  from the loop together with the other watched file descriptors, so no handler ever
+ *  interrupts (or jumps out of) the code that happens to be running.
+ */
+
+#include "jsh-event.h"
+#include "jsh-wait.h"
+#include <poll.h>
+#include <signal.h>
+#ifdef __linux__
+    #include <sys/epoll.h>
+    #include <sys/signalfd.h>
+#endif
+
+#define MAX_EVENTS  16      // max nb of events handled per epoll_wait() call
+#define EVENT_POLL_MS 10    // polling interval for watched children without a pidfd
+
+// a watched file descriptor or child process
+struct watch {
+    int fd;                             // fd to poll; -1 for a child without a pidfd
+    pid_t pid;                          // watched child process, or 0 for a plain fd
+    bool always_ready;                  // the fd can't be polled and is always considered readable
+    void (*fd_cb)(int, void*);
+    void (*pid_cb)(pid_t, int, void*);
+    void *arg;
+};
+
+// #################### helper function definitions ####################
+int add_watch(struct watch*);
+void remove_watch(int);
+int find_watch(int);
+void dispatch(int, void (*)(int));
+int next_signal(void);
+void check_children(void);
+bool reap_watch(int);
+#ifndef __linux__
+void event_sig_handler(int);
+#endif
+
+static const int event_signals[] = {SIGINT, SIGCHLD, SIGWINCH};
+#define NB_EVENT_SIGNALS (sizeof(event_signals)/sizeof(event_signals[0]))
+
+static struct watch *watches = NULL;
+static int nb_watches = 0;
+static int max_watches = 0;
+static int sigfd = -1;              // signalfd (Linux) or read end of the signal self-pipe
+static sigset_t orig_mask;          // the signal mask jsh was started with
+static bool running = false;
+#ifdef __linux__
+    static int epfd = -1;
+    static int intfd = -1;          // signalfd for SIGINT only, see event_wait_readable()
+    static int chldfd = -1;         // epoll instance with only the pidfds of the watched children
+#else
+    static int sigpipe_w = -1;      // write end of the signal self-pipe
+    static volatile sig_atomic_t got_sigint = 0;
+#endif
+
+int event_init(void) {
+    sigset_t mask;
+    int i;
+    sigemptyset(&mask);
+    for (i = 0; i < NB_EVENT_SIGNALS; i++)
+        sigaddset(&mask, event_signals[i]);
+
+    #ifdef __linux__
+        if ((epfd = epoll_create1(EPOLL_CLOEXEC)) < 0 || (chldfd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+            printerrno("event_init: couldn't create epoll instance");
+            return EXIT_FAILURE;
+        }
+        sigprocmask(SIG_BLOCK, &mask, &orig_mask);
+        if ((sigfd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC)) < 0) {
+            printerrno("event_init: couldn't create signalfd");
+            sigprocmask(SIG_SETMASK, &orig_mask, NULL);
+            return EXIT_FAILURE;
+        }
+        sigset_t intmask;
+        sigemptyset(&intmask);
+        sigaddset(&intmask, SIGINT);
+        intfd = signalfd(-1, &intmask, SFD_NONBLOCK | SFD_CLOEXEC);
+    #else
+        int p[2];
+        if (pipe(p) < 0) {
+            printerrno("event_init: couldn't create signal pipe");
+            return EXIT_FAILURE;
+        }
+        for (i = 0; i < 2; i++) {
+            fcntl(p[i], F_SETFD, FD_CLOEXEC);
+            fcntl(p[i], F_SETFL, O_NONBLOCK);
+        }
+        sigfd = p[0];
+        sigpipe_w = p[1];
+        sigprocmask(SIG_BLOCK, NULL, &orig_mask);
+
+        struct sigaction sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_handler = event_sig_handler;
+        sa.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+        for (i = 0; i < NB_EVENT_SIGNALS; i++)
+            sigaction(event_signals[i], &sa, NULL);
+    #endif
+
+    struct watch w = {sigfd, 0, false, NULL, NULL, NULL};
+    return add_watch(&w);
+}
+
+void event_restore_sigmask(void) {
+    if (sigfd == -1)
+        return;
+    #ifndef __linux__
+        int i;
+        for (i = 0; i < NB_EVENT_SIGNALS; i++)
+            signal(event_signals[i], SIG_DFL);
+    #endif
+    sigprocmask(SIG_SETMASK, &orig_mask, NULL);
+}
+
+int event_add_fd(int fd, void (*cb)(int, void*), void *arg) {
+    struct watch w = {fd, 0, false, cb, NULL, arg};
+    return add_watch(&w);
+}
+
+void event_remove_fd(int fd) {
+    int i = find_watch(fd);
+    if (i >= 0 && !watches[i].pid)
+        remove_watch(i);
+}
+
+int event_watch_pid(pid_t pid, void (*cb)(pid_t, int, void*), void *arg) {
+    // without pidfd, the child is checked with a non-blocking waitpid() on each SIGCHLD
+    struct watch w = {open_pidfd(pid), pid, false, NULL, cb, arg};
+    return add_watch(&w);
+}
+
+int event_reap_children(void) {
+    int i = 0, n = 0;
+    while (i < nb_watches)
+        if (watches[i].pid && reap_watch(i)) {
+            i = 0;  // the watches array has changed
+            n++;
+        }
+        else
+            i++;
+    return n;
+}
+
+int event_loop(void (*on_signal)(int)) {
+    int i, n;
+    running = true;
+    while (running) {
+        bool ready = false;
+        for (i = 0; i < nb_watches; i++)
+            ready = ready || watches[i].always_ready;
+
+        #ifdef __linux__
+            struct epoll_event evs[MAX_EVENTS];
+            if ((n = epoll_wait(epfd, evs, MAX_EVENTS, ready? 0 : -1)) < 0) {
+                if (errno == EINTR)
+                    continue;
+                printerrno("event_loop: epoll_wait failed");
+                return EXIT_FAILURE;
+            }
+            for (i = 0; i < n && running; i++)
+                dispatch(evs[i].data.fd, on_signal);
+        #else
+            struct pollfd pfds[nb_watches];
+            int nfds = 0;
+            for (i = 0; i < nb_watches; i++)
+                if (watches[i].fd != -1) {
+                    pfds[nfds].fd = watches[i].fd;
+                    pfds[nfds].events = POLLIN;
+                    pfds[nfds++].revents = 0;
+                }
+            if ((n = poll(pfds, nfds, ready? 0 : -1)) < 0) {
+                if (errno == EINTR)
+                    continue;
+                printerrno("event_loop: poll failed");
+                return EXIT_FAILURE;
+            }
+            for (i = 0; i < nfds && running; i++)
+                if (pfds[i].revents)
+                    dispatch(pfds[i].fd, on_signal);
+        #endif
+
+        for (i = 0; i < nb_watches && running; i++)
+            if (watches[i].always_ready)
+                dispatch(watches[i].fd, on_signal);
+    }
+    return EXIT_SUCCESS;
+}
+
+void event_loop_stop(void) {
+    running = false;
+}
+
+bool event_interrupted(void) {
+    #ifdef __linux__
+        // a blocked SIGINT stays pending until consumed here or read from the signalfd
+        sigset_t pending, intmask;
+        int signo;
+        if (sigfd == -1 || sigpending(&pending) < 0 || !sigismember(&pending, SIGINT))
+            return false;
+        sigemptyset(&intmask);
+        sigaddset(&intmask, SIGINT);
+        sigwait(&intmask, &signo);
+        return true;
+    #else
+        bool rv = got_sigint;
+        got_sigint = 0;
+        return rv;
+    #endif
+}
+
+int event_children_fd(void) {
+    #ifdef __linux__
+        return chldfd;
+    #else
+        return -1;
+    #endif
+}
+
+bool event_wait_children(void) {
+    int i;
+    for (;;) {
+        if (event_interrupted())
+            return false;
+        // children without a pidfd can only be checked with a non-blocking waitpid()
+        int timeout = -1;
+        for (i = 0; i < nb_watches; i++)
+            if (watches[i].pid && watches[i].fd == -1)
+                timeout = EVENT_POLL_MS;
+        #ifdef __linux__
+            struct pollfd pfds[2] = {{chldfd, POLLIN, 0}, {intfd, POLLIN, 0}};
+            int n = poll(pfds, (intfd != -1)? 2 : 1, timeout);
+        #else
+            int n = poll(NULL, 0, (timeout < 0)? EVENT_POLL_MS : timeout);
+        #endif
+        if ((n < 0 && errno != EINTR) || event_reap_children() > 0)
+            return true;
+    }
+}
+
+bool event_wait_readable(int fd) {
+    if (sigfd == -1)
+        return true;    // SIGINT isn't blocked: it interrupts the read() itself
+    for (;;) {
+        if (event_interrupted())
+            return false;
+        #ifdef __linux__
+            // the signalfd is readable as long as a SIGINT is pending
+            struct pollfd pfds[2] = {{fd, POLLIN, 0}, {intfd, POLLIN, 0}};
+            int n = poll(pfds, (intfd != -1)? 2 : 1, -1);
+        #else
+            // the signal handler interrupts poll()
+            struct pollfd pfds[1] = {{fd, POLLIN, 0}};
+            int n = poll(pfds, 1, -1);
+        #endif
+        if ((n < 0 && errno != EINTR) || (n > 0 && pfds[0].revents))
+            return true;    // let the read() report the data, EOF or error
+    }
+}
+
+// #################### helper functions ####################
+
+/*
+ * add_watch: add a copy of the provided watch to the watches array and the epoll set
+ * @return: EXIT_SUCCESS or EXIT_FAILURE
+ */
+int add_watch(struct watch *w) {
+    #ifdef __linux__
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.fd = w->fd;
+        if (w->fd != -1 && epoll_ctl(epfd, EPOLL_CTL_ADD, w->fd, &ev) < 0) {
+            if (errno != EPERM) {
+                printerrno("event: couldn't watch file descriptor %d", w->fd);
+                return EXIT_FAILURE;
+            }
+            w->always_ready = true; // e.g. stdin redirected from a regular file
+        }
+        if (w->pid && w->fd != -1)
+            epoll_ctl(chldfd, EPOLL_CTL_ADD, w->fd, &ev);
+    #endif
+    if (nb_watches == max_watches) {
+        max_watches = max_watches? max_watches*2 : 8;
+        watches = realloc(watches, sizeof(struct watch) * max_watches);
+    }
+    watches[nb_watches++] = *w;
+    return EXIT_SUCCESS;
+}
+
+/*
+ * remove_watch: remove the watch at index i (the caller is responsible for closing its fd)
+ */
+void remove_watch(int i) {
+    #ifdef __linux__
+        if (watches[i].fd != -1 && !watches[i].always_ready)
+            epoll_ctl(epfd, EPOLL_CTL_DEL, watches[i].fd, NULL);
+        if (watches[i].pid && watches[i].fd != -1)
+            epoll_ctl(chldfd, EPOLL_CTL_DEL, watches[i].fd, NULL);
+    #endif
+    watches[i] = watches[--nb_watches];
+}
+
+/*
+ * find_watch: returns the index of the watch for the provided fd, or -1 if not found
+ */
+int find_watch(int fd) {
+    int i;
+    for (i = 0; i < nb_watches; i++)
+        if (watches[i].fd == fd)
+            return i;
+    return -1;
+}
+
+/*
+ * dispatch: handle the readable file descriptor fd
+ */
+void dispatch(int fd, void (*on_signal)(int)) {
+    int signo;
+    if (fd == sigfd) {
+        while ((signo = next_signal()) > 0)
+            if (signo == SIGCHLD)
+                check_children();
+            else if (on_signal)
+                on_signal(signo);
+        return;
+    }
+    // note: an earlier callback may have removed the watch in the meantime
+    int i = find_watch(fd);
+    if (i < 0)
+        return;
+    if (watches[i].pid)
+        reap_watch(i);
+    else
+        watches[i].fd_cb(fd, watches[i].arg);
+}
+
+/*
+ * next_signal: returns the nb of the next received signal, or 0 if none
+ */
+int next_signal(void) {
+    #ifdef __linux__
+        struct signalfd_siginfo si;
+        if (read(sigfd, &si, sizeof(si)) != sizeof(si))
+            return 0;
+        return si.ssi_signo;
+    #else
+        unsigned char c;
+        while (read(sigfd, &c, 1) == 1)
+            // a SIGINT may already have been consumed by event_interrupted()
+            if (c != SIGINT || event_interrupted())
+                return c;
+        return 0;
+    #endif
+}
+
+/*
+ * check_children: on SIGCHLD, check the watched children without a pidfd
+ */
+void check_children(void) {
+    int i = 0;
+    while (i < nb_watches)
+        if (watches[i].pid && watches[i].fd == -1 && reap_watch(i))
+            i = 0;  // the watches array has changed
+        else
+            i++;
+}
+
+/*
+ * reap_watch: reap the child of the watch at index i, if terminated, and call its callback
+ * @return: true iff the child was reaped and the watch removed
+ */
+bool reap_watch(int i) {
+    struct watch w = watches[i];
+    int status = 0;
+    pid_t pid = waitpid(w.pid, &status, WNOHANG);
+    if (pid == 0 || (pid < 0 && errno != ECHILD))
+        return false;
+    remove_watch(i);
+    if (w.fd != -1)
+        close(w.fd);
+    printdebug("event: watched child %d terminated", w.pid);
+    w.pid_cb(w.pid, status, w.arg);
+    return true;
+}
+
+#ifndef __linux__
+/*
+ * event_sig_handler: async signal handler: only record the signal in the self-pipe
+ */
+void event_sig_handler(int signo) {
+    int saved_errno = errno;
+    unsigned char c = signo;
+    if (signo == SIGINT)
+        got_sigint = 1;
+    if (write(sigpipe_w, &c, 1) < 0) {}   // pipe full: the loop will wake up anyway
+    errno = saved_errno;
+}
+#endif
@@ -0,0 +1,112 @@
+/* This file is part of jsh.
+ *
+ * jsh: A basic UNIX shell implementation in C
+ * Copyright (C) 2014 Jo Van Bulck <jo.vanbulck@student.kuleuven.be>
+ *
+ * jsh is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * jsh is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with jsh.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef EVENT_H_INCLUDED
+#define EVENT_H_INCLUDED
+/* ^^ these are the include guards */
+
+#include "jsh-common.h"
+
+/*
+ * The jsh event loop: a single place that waits for terminal input, signals (SIGINT,
+ *  SIGCHLD, SIGWINCH) and child termination. On Linux it is built on epoll, with a
+ *  signalfd for the signals and pidfds for the children; elsewhere it falls back to
+ *  poll() and a self-pipe written to from the signal handlers.
+ */
+
+/*
+ * event_init: route SIGINT, SIGCHLD and SIGWINCH to the event loop. Should be called
+ *  once at startup, before any other event_* function.
+ * @return: EXIT_SUCCESS or EXIT_FAILURE
+ */
+int event_init(void);
+
+/*
+ * event_restore_sigmask: restore the signal mask and dispositions jsh was started with.
+ *  Should be called in a forked child, before it executes a command.
+ */
+void event_restore_sigmask(void);
+
+/*
+ * event_add_fd: call cb(fd, arg) from the event loop whenever fd is readable.
+ *  File descriptors that can't be polled (e.g. regular files) are considered always readable.
+ * @return: EXIT_SUCCESS or EXIT_FAILURE
+ */
+int event_add_fd(int, void (*)(int, void*), void*);
+
+/*
+ * event_remove_fd: stop watching the provided file descriptor
+ */
+void event_remove_fd(int);
+
+/*
+ * event_watch_pid: reap the provided child process from the event loop when it terminates,
+ *  and call cb(pid, status, arg) with its waitpid() status
+ * @return: EXIT_SUCCESS or EXIT_FAILURE
+ */
+int event_watch_pid(pid_t, void (*)(pid_t, int, void*), void*);
+
+/*
+ * event_reap_children: reap the watched children that terminated and call their callbacks,
+ *  without blocking. Meant for code that waits for watched children outside the event loop.
+ * @return: the nb of reaped children
+ */
+int event_reap_children(void);
+
+/*
+ * event_children_fd: returns a file descriptor that is readable when a watched child with a
+ *  pidfd terminated (i.e. when event_reap_children() has work), or -1 if not supported. Meant
+ *  to be polled by code that blocks outside the event loop, e.g. waiting for a command.
+ */
+int event_children_fd(void);
+
+/*
+ * event_wait_children: block until any watched child terminated, reaping it and calling its
+ *  callback as event_reap_children() does, or until a SIGINT (^C) arrives
+ * @return: false iff interrupted by ^C (which is consumed, as by event_interrupted())
+ */
+bool event_wait_children(void);
+
+/*
+ * event_loop: dispatch events until event_loop_stop() is called. SIGCHLD is handled
+ *  internally; SIGINT and SIGWINCH are passed to the on_signal function.
+ * @return: EXIT_SUCCESS or EXIT_FAILURE if waiting for events failed
+ */
+int event_loop(void (*)(int));
+
+/*
+ * event_loop_stop: let event_loop() return after the current event
+ */
+void event_loop_stop(void);
+
+/*
+ * event_interrupted: returns true iff a SIGINT (^C) arrived since the last call, and
+ *  consumes it. Meant to be checked by long running loops outside the event loop.
+ */
+bool event_interrupted(void);
+
+/*
+ * event_wait_readable: block until the provided fd is readable (or at EOF) or a SIGINT (^C)
+ *  arrives. Meant for reads outside the event loop that could block (e.g. on the terminal):
+ *  SIGINT is blocked, so it can't interrupt the read() itself.
+ * @return: false iff interrupted by ^C (which is consumed, as by event_interrupted())
+ */
+bool event_wait_readable(int);
+
+#endif //EVENT_H_INCLUDED
@@ -0,0 +1,786 @@
+/* This file is part of jsh.
+ *
+ * jsh: A basic UNIX shell implementation in C
+ * Copyright (C) 2014 Jo Van Bulck <jo.vanbulck@student.kuleuven.be>
+ *
+ * jsh is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * jsh is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with jsh.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * jsh-git.c: git repository information for the prompt, read from the repository's files
+ *  rather than by running git: finding the git directory is a few stat() calls, and the
+ *  current branch is only read again when the HEAD file changed. Whether the work tree has
+ *  unstaged changes is computed in a background thread, that compares the stat data cached in
+ *  the index with lstat() results (in parallel), and only again when inotify reported changes
+ *  of the index or the work tree; the prompt just shows the last computed value.
+ */
+
+#include "jsh-git.h"
+#include <pthread.h>
+#include <stdint.h>
+#ifdef __linux__
+    #include <sys/inotify.h>
+#endif
+
+#define GIT_CACHE_SIZE      16      // nb of directories for which the git information is cached
+#define GIT_HEAD_MAX        512     // max length of the HEAD file that is read
+#define GIT_ABBREV_LENGTH   7       // length of the abbreviated commit hash of a detached HEAD
+#define GIT_REF_PREFIX      "ref: refs/heads/"
+#define GIT_SCAN_THREADS    8       // max nb of threads that lstat() the work tree in parallel
+#define GIT_SCAN_MIN_ENTRIES 2048   // min nb of index entries per scan thread
+#define GIT_READ_CHUNK      (64 << 10)  // chunk size for hashing a file
+#define GIT_WATCH_EVENTS    (IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | \
+                                IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF)
+
+// the index file format, see git's Documentation/technical/index-format.txt
+#define INDEX_HEADER_SIZE   12      // "DIRC", version, nb of entries
+#define INDEX_STAT_SIZE     40      // ctime, mtime, dev, ino, mode, uid, gid, size: 32-bit fields
+#define INDEX_ASSUME_VALID  0x8000
+#define INDEX_EXTENDED      0x4000
+#define INDEX_STAGE_MASK    0x3000
+#define INDEX_SKIP_WORKTREE 0x4000  // extended flags
+#define INDEX_INTENT_TO_ADD 0x2000
+#define INDEX_GITLINK       0160000 // mode of a submodule entry
+
+#ifdef __APPLE__
+    #define MTIME_NSEC(st)  ((st).st_mtimespec.tv_nsec)
+    #define CTIME_NSEC(st)  ((st).st_ctimespec.tv_nsec)
+#else
+    #define MTIME_NSEC(st)  ((st).st_mtim.tv_nsec)
+    #define CTIME_NSEC(st)  ((st).st_ctim.tv_nsec)
+#endif
+
+struct git_info {
+    char *cwd;                  // the directory, or NULL for an unused cache entry
+    char *gitdir;               // its git directory
+    char *worktree;             // the top directory of its work tree, or NULL if unknown
+    char *head;                 // the path of the HEAD file in gitdir
+    struct stat head_stat;      // stat() of the HEAD file when branch was read
+    char branch[GIT_HEAD_MAX];  // the current branch or abbreviated commit hash
+};
+
+struct index_entry {
+    const char *name;           // the path, relative to the work tree
+    uint32_t ctime_s, ctime_ns, mtime_s, mtime_ns, ino, mode, size;
+    const unsigned char *hash;  // the object name of the staged blob
+    bool skip;                  // assume-valid, skip-worktree, submodule or sparse directory entry
+    bool changed;               // unmerged or intent-to-add entry: always a change
+};
+
+struct dirty_tracker {
+    char *gitdir;
+    char *worktree;
+    int ifd;                    // inotify instance watching the index and the work tree, or -1
+    int gitdir_wd;              // its watch descriptor for gitdir
+    int dirty;                  // 1 iff the work tree has unstaged changes, 0 if not, -1 if unknown
+    bool stale;                 // whether or not dirty should be recomputed
+    bool running;               // whether or not a scan_worktree() thread is running
+    bool watching;              // whether or not all work tree directories are watched
+    int refs;                   // nb of references: the tracker variable and the running thread
+};
+
+struct scan {
+    const char *worktree;
+    struct index_entry *entries;
+    int from, to;               // the range of entries to check
+    time_t index_mtime;         // entries modified at or after the index are 'racily clean'
+    int hashlen;                // 20 for SHA-1, 32 for SHA-256 repositories
+    bool filemode;              // whether or not to compare the executable bit (core.filemode)
+    int *found;                 // set by the first thread that finds a change
+};
+
+struct sha1_ctx {
+    uint32_t h[5];
+    uint64_t length;
+    unsigned char block[64];
+    size_t used;
+};
+
+// #################### helper function definitions ####################
+struct git_info *lookup_git_info(void);
+char *find_git_dir(const char*, char**);
+char *read_gitdir_file(const char*, const char*);
+bool read_head(struct git_info*);
+void free_git_info(struct git_info*);
+struct dirty_tracker *new_tracker(struct git_info*);
+void release_tracker(struct dirty_tracker*);
+bool read_events(struct dirty_tracker*);
+void *scan_worktree(void*);
+int index_dirty(struct dirty_tracker*, bool*);
+char *read_config(const char*);
+bool config_is(const char*, const char*, const char*);
+int parse_index(const unsigned char*, size_t, int, struct index_entry**, bool*);
+void free_entries(struct index_entry*, int, bool);
+bool watch_dirs(struct dirty_tracker*, struct index_entry*, int);
+void *scan_entries(void*);
+bool entry_changed(struct scan*, struct index_entry*);
+bool same_blob(const char*, struct stat*, const unsigned char*);
+uint32_t be32(const unsigned char*);
+void sha1_init(struct sha1_ctx*);
+void sha1_update(struct sha1_ctx*, const void*, size_t);
+void sha1_final(struct sha1_ctx*, unsigned char*);
+void sha1_block(struct sha1_ctx*, const unsigned char*);
+
+static struct git_info cache[GIT_CACHE_SIZE];
+static int next_victim = 0;     // the cache entry to be replaced next (round robin)
+static struct dirty_tracker *tracker = NULL;    // for the repository of the last git_dirty() call
+static pthread_mutex_t tracker_lock = PTHREAD_MUTEX_INITIALIZER;
+static bool in_worktree = false;   // whether or not the last git_dirty() call was in a work tree
+static pthread_cond_t scan_done = PTHREAD_COND_INITIALIZER;    // broadcast when a scan completes
+
+const char *git_dir(void) {
+    struct git_info *info = lookup_git_info();
+    return info? info->gitdir : NULL;
+}
+
+const char *git_branch(void) {
+    struct git_info *info = lookup_git_info();
+    return info? info->branch : NULL;
+}
+
+int git_dirty(void) {
+    struct git_info *info = lookup_git_info();
+    pthread_mutex_lock(&tracker_lock);
+    if (!(in_worktree = (info != NULL && info->worktree != NULL))) {
+        pthread_mutex_unlock(&tracker_lock);
+        return -1;
+    }
+    if (tracker != NULL && strcmp(tracker->gitdir, info->gitdir) != 0) {
+        release_tracker(tracker);
+        tracker = NULL;
+    }
+    if (tracker == NULL)
+        tracker = new_tracker(info);
+    // without (complete) inotify watches, each prompt triggers a new scan
+    if (read_events(tracker) || (!tracker->watching && !tracker->running))
+        tracker->stale = true;
+    if (tracker->stale && !tracker->running) {
+        pthread_t thread;
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+        tracker->refs++;
+        tracker->running = true;
+        tracker->stale = false;
+        if (pthread_create(&thread, &attr, scan_worktree, tracker) != 0) {
+            tracker->refs--;
+            tracker->running = false;
+        }
+        pthread_attr_destroy(&attr);
+    }
+    int dirty = tracker->dirty;
+    pthread_mutex_unlock(&tracker_lock);
+    return dirty;
+}
+
+void git_dirty_invalidate(void) {
+    pthread_mutex_lock(&tracker_lock);
+    if (tracker != NULL)
+        tracker->stale = true;
+    pthread_mutex_unlock(&tracker_lock);
+}
+
+int git_dirty_wait(void) {
+    pthread_mutex_lock(&tracker_lock);
+    while (tracker != NULL && tracker->running)
+        pthread_cond_wait(&scan_done, &tracker_lock);
+    int dirty = (tracker && in_worktree)? tracker->dirty : -1;
+    pthread_mutex_unlock(&tracker_lock);
+    return dirty;
+}
+
+// #################### helper functions ####################
+
+/*
+ * lookup_git_info: returns the up to date cache entry for the current working directory,
+ *  (re-)reading the git directory and HEAD file as needed; or NULL if the cwd isn't in a git
+ *  repository. Directories that aren't in a repository aren't cached, so a new 'git init'
+ *  is noticed immediately.
+ */
+struct git_info *lookup_git_info(void) {
+    int i;
+    struct stat st;
+    char *cwd = getcwd(NULL, 0);
+    if (cwd == NULL)
+        return NULL;
+    for (i = 0; i < GIT_CACHE_SIZE && (cache[i].cwd == NULL || strcmp(cache[i].cwd, cwd) != 0); i++);
+    if (i < GIT_CACHE_SIZE) {
+        struct git_info *info = &cache[i];
+        free(cwd);
+        if (stat(info->head, &st) == 0) {
+            // note: git replaces HEAD by renaming a new file over it, so the inode changes as well
+            if (st.st_mtime == info->head_stat.st_mtime && st.st_ino == info->head_stat.st_ino && st.st_size == info->head_stat.st_size)
+                return info;
+            printdebug("git: HEAD of '%s' changed", info->gitdir);
+            if (read_head(info))
+                return info;
+        }
+        // the repository moved or was removed: look it up again
+        cwd = strclone(info->cwd);
+        free_git_info(info);
+    }
+    
+    char *worktree;
+    char *gitdir = find_git_dir(cwd, &worktree);
+    if (gitdir == NULL) {
+        free(cwd);
+        return NULL;
+    }
+    struct git_info *info = &cache[next_victim];
+    next_victim = (next_victim + 1) % GIT_CACHE_SIZE;
+    free_git_info(info);
+    info->cwd = cwd;
+    info->gitdir = gitdir;
+    info->worktree = worktree;
+    info->head = concat(2, gitdir, "/HEAD");
+    if (!read_head(info)) {
+        free_git_info(info);
+        return NULL;
+    }
+    printdebug("git: '%s' is in git directory '%s'", cwd, gitdir);
+    return info;
+}
+
+/*
+ * find_git_dir: returns a malloc()ed copy of the git directory for the provided directory:
+ *  $GIT_DIR iff set; else walking up from the directory, the first '.git' directory or the
+ *  directory in a '.git' file ('gitdir: path', as used for worktrees and submodules); or NULL
+ *  if there is none
+ * @arg worktree: set to a malloc()ed copy of the top directory of the work tree: the directory
+ *  with the '.git' directory or file, or $GIT_WORK_TREE for $GIT_DIR; or NULL if unknown
+ */
+char *find_git_dir(const char *dir, char **worktree) {
+    struct stat st;
+    char *env = getenv("GIT_DIR");
+    if (env != NULL && *env != '\0') {
+        *worktree = getenv("GIT_WORK_TREE")? strclone(getenv("GIT_WORK_TREE")) : NULL;
+        return strclone(env);
+    }
+    
+    char *path = strclone(dir), *end, *gitdir = NULL;
+    while (gitdir == NULL) {
+        char *dotgit = concat(2, path, (strcmp(path, "/") == 0)? ".git" : "/.git");
+        if (stat(dotgit, &st) == 0 && S_ISDIR(st.st_mode))
+            gitdir = dotgit;
+        else {
+            if (stat(dotgit, &st) == 0 && S_ISREG(st.st_mode))
+                gitdir = read_gitdir_file(dotgit, path);
+            free(dotgit);
+        }
+        // continue in the parent directory, up to the root
+        if (gitdir != NULL || (end = strrchr(path, '/')) == NULL || strcmp(path, "/") == 0)
+            break;
+        end[(end == path)? 1 : 0] = '\0';
+    }
+    *worktree = gitdir? path : NULL;
+    if (gitdir == NULL)
+        free(path);
+    return gitdir;
+}
+
+/*
+ * read_gitdir_file: returns the malloc()ed git directory in the '.git' file at the provided path,
+ *  relative to the provided directory with that file unless absolute; or NULL if there is none
+ */
+char *read_gitdir_file(const char *file, const char *dir) {
+    char buf[PATH_MAX + 16];
+    int fd = open(file, O_RDONLY);
+    if (fd == -1)
+        return NULL;
+    ssize_t len = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (len <= 0)
+        return NULL;
+    buf[len] = '\0';
+    buf[strcspn(buf, "\r\n")] = '\0';
+    if (strncmp(buf, "gitdir: ", strlen("gitdir: ")) != 0)
+        return NULL;
+    char *path = buf + strlen("gitdir: ");
+    return (*path == '/')? strclone(path) : concat(3, dir, "/", path);
+}
+
+/*
+ * read_head: read the branch (or the abbreviated commit hash for a detached HEAD) of the
+ *  provided cache entry from its HEAD file, and remember the file's stat()
+ * @return: true on success
+ */
+bool read_head(struct git_info *info) {
+    int fd = open(info->head, O_RDONLY);
+    if (fd == -1)
+        return false;
+    ssize_t len = -1;
+    if (fstat(fd, &info->head_stat) == 0)
+        len = read(fd, info->branch, sizeof(info->branch) - 1);
+    close(fd);
+    if (len <= 0)
+        return false;
+    info->branch[len] = '\0';
+    info->branch[strcspn(info->branch, "\r\n")] = '\0';
+    if (strncmp(info->branch, GIT_REF_PREFIX, strlen(GIT_REF_PREFIX)) == 0)
+        memmove(info->branch, info->branch + strlen(GIT_REF_PREFIX), strlen(info->branch + strlen(GIT_REF_PREFIX)) + 1);
+    else if (strncmp(info->branch, "ref: ", strlen("ref: ")) == 0)
+        memmove(info->branch, info->branch + strlen("ref: "), strlen(info->branch + strlen("ref: ")) + 1);
+    else if (strlen(info->branch) > GIT_ABBREV_LENGTH)
+        info->branch[GIT_ABBREV_LENGTH] = '\0';     // detached HEAD: abbreviated commit hash
+    return true;
+}
+
+/*
+ * free_git_info: free the strings of the provided cache entry, marking it unused
+ */
+void free_git_info(struct git_info *info) {
+    free(info->cwd);
+    free(info->gitdir);
+    free(info->head);
+    free(info->worktree);
+    info->cwd = info->gitdir = info->head = info->worktree = NULL;
+}
+
+/*
+ * new_tracker: returns a new dirty_tracker for the repository of the provided cache entry,
+ *  watching its git directory for index changes
+ */
+struct dirty_tracker *new_tracker(struct git_info *info) {
+    struct dirty_tracker *t = calloc(1, sizeof(struct dirty_tracker));
+    t->gitdir = strclone(info->gitdir);
+    t->worktree = strclone(info->worktree);
+    t->ifd = t->gitdir_wd = -1;
+    t->dirty = -1;
+    t->stale = true;
+    t->refs = 1;
+    #ifdef __linux__
+        if ((t->ifd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) != -1)
+            t->gitdir_wd = inotify_add_watch(t->ifd, t->gitdir, IN_CLOSE_WRITE | IN_MOVED_TO | IN_DELETE);
+    #endif
+    return t;
+}
+
+/*
+ * release_tracker: drop a reference to the provided tracker, freeing it after the last one;
+ *  should be called with tracker_lock held
+ */
+void release_tracker(struct dirty_tracker *t) {
+    if (--t->refs > 0)
+        return;
+    if (t->ifd != -1)
+        close(t->ifd);
+    free(t->gitdir);
+    free(t->worktree);
+    free(t);
+}
+
+/*
+ * read_events: read the pending inotify events of the provided tracker
+ * @return: true iff the index or the work tree changed (or events were lost)
+ */
+bool read_events(struct dirty_tracker *t) {
+    bool changed = false;
+    #ifdef __linux__
+        char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+        ssize_t len, i;
+        while (t->ifd != -1 && (len = read(t->ifd, buf, sizeof(buf))) > 0)
+            for (i = 0; i < len; i += sizeof(struct inotify_event) + ((struct inotify_event*) (buf+i))->len) {
+                struct inotify_event *ev = (struct inotify_event*) (buf+i);
+                // in the git directory itself, only the index matters
+                if (ev->wd != t->gitdir_wd || (ev->len > 0 && strcmp(ev->name, "index") == 0) || (ev->mask & IN_Q_OVERFLOW))
+                    changed = true;
+            }
+    #endif
+    return changed;
+}
+
+/*
+ * scan_worktree: thread main function that computes whether the work tree of the provided
+ *  tracker has unstaged changes
+ */
+void *scan_worktree(void *arg) {
+    struct dirty_tracker *t = arg;
+    bool watching = false;
+    int dirty = index_dirty(t, &watching);
+    pthread_mutex_lock(&tracker_lock);
+    t->dirty = dirty;
+    t->watching = watching;
+    t->running = false;
+    release_tracker(t);
+    pthread_cond_broadcast(&scan_done);
+    pthread_mutex_unlock(&tracker_lock);
+    return NULL;
+}
+
+/*
+ * index_dirty: compare the entries of the index of the provided tracker with the files in
+ *  its work tree, like 'git diff --quiet', using GIT_SCAN_THREADS threads for a large index.
+ *  The directories of the index entries are (re-)added to the inotify watches.
+ * @arg watching: set to true iff all directories are watched
+ * @return: 1 iff there are unstaged changes, 0 if not, or -1 if the index couldn't be read
+ */
+int index_dirty(struct dirty_tracker *t, bool *watching) {
+    char *path = concat(2, t->gitdir, "/index"), *config = read_config(t->gitdir);
+    struct scan scans[GIT_SCAN_THREADS];
+    pthread_t threads[GIT_SCAN_THREADS];
+    struct index_entry *entries;
+    struct stat st;
+    bool owned_names;
+    size_t len;
+    int i, n, nthreads, found = 0, hashlen = config_is(config, "objectformat", "sha256")? 32 : 20;
+    bool filemode = !config_is(config, "filemode", "false");
+    free(config);
+    
+    int fd = open(path, O_RDONLY);
+    free(path);
+    if (fd == -1)
+        return (errno == ENOENT)? 0 : -1;   // nothing staged yet
+    unsigned char *buf = (fstat(fd, &st) == 0)? (unsigned char*) read_fd(fd, &len) : NULL;
+    close(fd);
+    if (buf == NULL || (n = parse_index(buf, len, hashlen, &entries, &owned_names)) == -1) {
+        free(buf);
+        return -1;
+    }
+    *watching = (t->ifd != -1) && watch_dirs(t, entries, n);
+    
+    long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+    nthreads = n / GIT_SCAN_MIN_ENTRIES;
+    nthreads = (nthreads < 1)? 1 : (nthreads > GIT_SCAN_THREADS)? GIT_SCAN_THREADS : nthreads;
+    nthreads = (ncpus > 0 && nthreads > ncpus)? ncpus : nthreads;
+    for (i = 0; i < nthreads; i++) {
+        scans[i] = (struct scan) {t->worktree, entries, i * (long) n / nthreads, (i+1) * (long) n / nthreads,
+            st.st_mtime, hashlen, filemode, &found};
+        if (i > 0 && pthread_create(&threads[i], NULL, scan_entries, &scans[i]) != 0)
+            threads[i] = 0, scan_entries(&scans[i]);
+    }
+    scan_entries(&scans[0]);
+    for (i = 1; i < nthreads; i++)
+        if (threads[i] != 0)
+            pthread_join(threads[i], NULL);
+    free_entries(entries, n, owned_names);
+    free(buf);
+    return found;
+}
+
+/*
+ * read_config: returns the malloc()ed content of the config file of the provided git
+ *  directory (in the common directory of a worktree), or NULL if it couldn't be read
+ */
+char *read_config(const char *gitdir) {
+    char common[PATH_MAX] = "", *path = concat(2, gitdir, "/commondir");
+    int fd = open(path, O_RDONLY);
+    free(path);
+    if (fd != -1) {
+        ssize_t len = read(fd, common, sizeof(common) - 1);
+        common[(len > 0)? len : 0] = '\0';
+        common[strcspn(common, "\r\n")] = '\0';
+        close(fd);
+    }
+    if (*common == '\0')
+        path = concat(2, gitdir, "/config");
+    else
+        path = (*common == '/')? concat(2, common, "/config") : concat(4, gitdir, "/", common, "/config");
+    fd = open(path, O_RDONLY);
+    free(path);
+    if (fd == -1)
+        return NULL;
+    char *config = read_fd(fd, NULL);
+    close(fd);
+    return config;
+}
+
+/*
+ * config_is: returns whether or not the provided config file content has a line 'key = value'
+ *  (case insensitive, ignoring the section)
+ */
+bool config_is(const char *config, const char *key, const char *value) {
+    const char *line, *p;
+    for (line = config; line != NULL && *line != '\0'; line = (p = strchr(line, '\n'))? p+1 : NULL) {
+        line += strspn(line, " \t");
+        if (strncasecmp(line, key, strlen(key)) != 0)
+            continue;
+        p = line + strlen(key);
+        p += strspn(p, " \t");
+        if (*p++ != '=')
+            continue;
+        p += strspn(p, " \t");
+        if (strncasecmp(p, value, strlen(value)) == 0 && strchr(" \t\r\n", p[strlen(value)]) != NULL)
+            return true;
+    }
+    return false;
+}
+
+/*
+ * parse_index: parse the entries of the provided index file content (version 2, 3 or 4)
+ *  into a malloc()ed array
+ * @arg owned_names: set to true iff the names of the entries are malloc()ed (version 4, with
+ *  prefix compressed paths); else they point into the provided buffer
+ * @return: the nb of entries, or -1 if the index is invalid
+ */
+int parse_index(const unsigned char *buf, size_t len, int hashlen, struct index_entry **entries, bool *owned_names) {
+    if (len < INDEX_HEADER_SIZE + hashlen || memcmp(buf, "DIRC", 4) != 0)
+        return -1;
+    uint32_t version = be32(buf+4), n = be32(buf+8), i;
+    if (version < 2 || version > 4 || n > len / INDEX_STAT_SIZE)
+        return -1;
+    *owned_names = (version == 4);
+    *entries = malloc(sizeof(struct index_entry) * (n+1));
+    const unsigned char *p = buf + INDEX_HEADER_SIZE, *end = buf + len - hashlen, *name, *nul;
+    const char *prev = "";
+    for (i = 0; i < n; i++) {
+        struct index_entry *e = &(*entries)[i];
+        size_t header = INDEX_STAT_SIZE + hashlen + 2;
+        if (p + header > end)
+            goto fail;
+        e->ctime_s = be32(p);
+        e->ctime_ns = be32(p+4);
+        e->mtime_s = be32(p+8);
+        e->mtime_ns = be32(p+12);
+        e->ino = be32(p+20);
+        e->mode = be32(p+24);
+        e->size = be32(p+36);
+        e->hash = p + INDEX_STAT_SIZE;
+        unsigned flags = (p[header-2] << 8) | p[header-1], extended = 0;
+        if (flags & INDEX_EXTENDED) {
+            if (version < 3 || p + header + 2 > end)
+                goto fail;
+            extended = (p[header] << 8) | p[header+1];
+            header += 2;
+        }
+        e->skip = (flags & INDEX_ASSUME_VALID) || (extended & INDEX_SKIP_WORKTREE) ||
+            (e->mode & S_IFMT) == INDEX_GITLINK || S_ISDIR(e->mode);
+        e->changed = (flags & INDEX_STAGE_MASK) || (extended & INDEX_INTENT_TO_ADD);
+        name = p + header;
+        
+        if (version == 4) {
+            // the nb of chars to strip from the previous path (an offset varint), then a suffix
+            size_t strip = 0, prevlen = strlen(prev);
+            unsigned char c;
+            do {
+                if (name >= end)
+                    goto fail;
+                c = *name++;
+                strip = (strip << 7) | (c & 0x7f);
+                if (c & 0x80)
+                    strip++;
+            } while (c & 0x80);
+            if (strip > prevlen || (nul = memchr(name, '\0', end - name)) == NULL)
+                goto fail;
+            char *path = malloc(prevlen - strip + (nul - name) + 1);
+            memcpy(path, prev, prevlen - strip);
+            memcpy(path + prevlen - strip, name, nul - name + 1);
+            e->name = prev = path;
+            p = nul + 1;
+        }
+        else {
+            if ((nul = memchr(name, '\0', end - name)) == NULL)
+                goto fail;
+            e->name = (const char*) name;
+            p += (header + (nul - name) + 8) & ~7;  // padded with 1-8 '\0' chars to a multiple of 8
+        }
+    }
+    return n;
+
+fail:
+    free_entries(*entries, i, *owned_names);
+    return -1;
+}
+
+/*
+ * free_entries: free the provided array of n index entries
+ */
+void free_entries(struct index_entry *entries, int n, bool owned_names) {
+    int i;
+    for (i = 0; owned_names && i < n; i++)
+        free((char*) entries[i].name);
+    free(entries);
+}
+
+/*
+ * watch_dirs: add inotify watches for the top directory of the work tree and the directories
+ *  of the provided index entries
+ * @return: true iff all directories are watched
+ */
+bool watch_dirs(struct dirty_tracker *t, struct index_entry *entries, int n) {
+    bool ok = true;
+    #ifdef __linux__
+        char path[PATH_MAX];
+        const char *prev = "";
+        int i, prevlen = -1;
+        ok = inotify_add_watch(t->ifd, t->worktree, GIT_WATCH_EVENTS) != -1;
+        for (i = 0; i < n && ok; i++) {
+            const char *slash = strrchr(entries[i].name, '/');
+            int len = slash? slash - entries[i].name : 0;
+            // the entries are sorted, so most entries share the directory of the previous one
+            if (entries[i].skip || len == 0 || (len == prevlen && strncmp(entries[i].name, prev, len) == 0))
+                continue;
+            prev = entries[i].name;
+            prevlen = len;
+            snprintf(path, sizeof(path), "%s/%.*s", t->worktree, len, entries[i].name);
+            ok = inotify_add_watch(t->ifd, path, GIT_WATCH_EVENTS) != -1 || errno == ENOENT || errno == ENOTDIR;
+        }
+    #endif
+    return ok;
+}
+
+/*
+ * scan_entries: thread main function that checks the range of index entries of the provided
+ *  scan, until any thread found a change
+ */
+void *scan_entries(void *arg) {
+    struct scan *sc = arg;
+    int i;
+    for (i = sc->from; i < sc->to && !__atomic_load_n(sc->found, __ATOMIC_RELAXED); i++)
+        if (entry_changed(sc, &sc->entries[i]))
+            __atomic_store_n(sc->found, 1, __ATOMIC_RELAXED);
+    return NULL;
+}
+
+/*
+ * entry_changed: returns whether or not the file of the provided index entry changed: like git,
+ *  an entry with unchanged stat data isn't changed (unless it is 'racily clean', i.e. modified
+ *  in the same second as the index was written); else its content is hashed and compared
+ */
+bool entry_changed(struct scan *sc, struct index_entry *e) {
+    char path[PATH_MAX];
+    struct stat st;
+    if (e->skip)
+        return false;
+    if (e->changed)
+        return true;
+    snprintf(path, sizeof(path), "%s/%s", sc->worktree, e->name);
+    if (lstat(path, &st) != 0)
+        return true;
+    if (S_ISLNK(e->mode)? !S_ISLNK(st.st_mode) : !S_ISREG(st.st_mode))
+        return true;
+    if (S_ISREG(st.st_mode) && sc->filemode && ((st.st_mode & S_IXUSR) != 0) != ((e->mode & S_IXUSR) != 0))
+        return true;
+    if ((uint32_t) st.st_size != e->size)
+        return true;
+    if ((uint32_t) st.st_mtime == e->mtime_s && (uint32_t) MTIME_NSEC(st) == e->mtime_ns &&
+        (uint32_t) st.st_ctime == e->ctime_s && (uint32_t) CTIME_NSEC(st) == e->ctime_ns &&
+        (uint32_t) st.st_ino == e->ino && (time_t) e->mtime_s < sc->index_mtime)
+        return false;
+    return sc->hashlen != 20 || !same_blob(path, &st, e->hash);
+}
+
+/*
+ * same_blob: returns whether or not the git blob object name (SHA-1) of the file at the
+ *  provided path (the target of a symbolic link) equals the provided hash
+ */
+bool same_blob(const char *path, struct stat *st, const unsigned char *hash) {
+    char header[32], buf[GIT_READ_CHUNK];
+    unsigned char sha[20];
+    struct sha1_ctx ctx;
+    ssize_t len;
+    off_t total = 0;
+    sha1_init(&ctx);
+    sha1_update(&ctx, header, snprintf(header, sizeof(header), "blob %lld", (long long) st->st_size) + 1);
+    if (S_ISLNK(st->st_mode)) {
+        if ((total = readlink(path, buf, sizeof(buf))) < 0)
+            return false;
+        sha1_update(&ctx, buf, total);
+    }
+    else {
+        int fd = open(path, O_RDONLY);
+        if (fd == -1)
+            return false;
+        while ((len = read(fd, buf, sizeof(buf))) > 0) {
+            sha1_update(&ctx, buf, len);
+            total += len;
+        }
+        close(fd);
+    }
+    if (total != st->st_size)
+        return false;
+    sha1_final(&ctx, sha);
+    return memcmp(sha, hash, sizeof(sha)) == 0;
+}
+
+/*
+ * be32: returns the big endian 32-bit integer at the provided address
+ */
+uint32_t be32(const unsigned char *p) {
+    return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) | ((uint32_t) p[2] << 8) | p[3];
+}
+
+// #################### SHA-1 (FIPS 180-4), for git blob object names ####################
+#define ROL32(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+
+void sha1_init(struct sha1_ctx *ctx) {
+    static const uint32_t init[5] = {0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0};
+    memcpy(ctx->h, init, sizeof(init));
+    ctx->length = ctx->used = 0;
+}
+
+void sha1_update(struct sha1_ctx *ctx, const void *data, size_t len) {
+    const unsigned char *p = data;
+    ctx->length += len;
+    while (len > 0) {
+        size_t n = (len < 64 - ctx->used)? len : 64 - ctx->used;
+        memcpy(ctx->block + ctx->used, p, n);
+        ctx->used += n;
+        p += n;
+        len -= n;
+        if (ctx->used == 64) {
+            sha1_block(ctx, ctx->block);
+            ctx->used = 0;
+        }
+    }
+}
+
+void sha1_final(struct sha1_ctx *ctx, unsigned char *out) {
+    uint64_t bits = ctx->length * 8;
+    unsigned char pad[72] = {0x80};
+    int i;
+    size_t padlen = (ctx->used < 56)? 56 - ctx->used : 120 - ctx->used;
+    for (i = 0; i < 8; i++)
+        pad[padlen + i] = bits >> (56 - 8*i);
+    sha1_update(ctx, pad, padlen + 8);
+    for (i = 0; i < 20; i++)
+        out[i] = ctx->h[i/4] >> (24 - 8*(i%4));
+}
+
+void sha1_block(struct sha1_ctx *ctx, const unsigned char *block) {
+    uint32_t w[80], a = ctx->h[0], b = ctx->h[1], c = ctx->h[2], d = ctx->h[3], e = ctx->h[4], f, k, tmp;
+    int i;
+    for (i = 0; i < 16; i++)
+        w[i] = be32(block + 4*i);
+    for (; i < 80; i++)
+        w[i] = ROL32(w[i-3] ^ w[i-8] ^ w[i-14] ^ w[i-16], 1);
+    for (i = 0; i < 80; i++) {
+        if (i < 20) {
+            f = (b & c) | (~b & d);
+            k = 0x5a827999;
+        }
+        else if (i < 40) {
+            f = b ^ c ^ d;
+            k = 0x6ed9eba1;
+        }
+        else if (i < 60) {
+            f = (b & c) | (b & d) | (c & d);
+            k = 0x8f1bbcdc;
+        }
+        else {
+            f = b ^ c ^ d;
+            k = 0xca62c1d6;
+        }
+        tmp = ROL32(a, 5) + f + e + k + w[i];
+        e = d;
+        d = c;
+        c = ROL32(b, 30);
+        b = a;
+        a = tmp;
+    }
+    ctx->h[0] += a;
+    ctx->h[1] += b;
+    ctx->h[2] += c;
+    ctx->h[3] += d;
+    ctx->h[4] += e;
+}
@@ -0,0 +1,65 @@
+/* This file is part of jsh.
+ *
+ * jsh: A basic UNIX shell implementation in C
+ * Copyright (C) 2014 Jo Van Bulck <jo.vanbulck@student.kuleuven.be>
+ *
+ * jsh is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * jsh is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with jsh.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GIT_H_INCLUDED
+#define GIT_H_INCLUDED
+/* ^^ these are the include guards */
+
+#include "jsh-common.h"
+
+/*
+ * git_dir: returns the git directory of the repository the current working directory is in
+ *  ($GIT_DIR, or the first '.git' directory or 'gitdir:' file found walking up from the cwd),
+ *  or NULL if it isn't in a git repository. The returned string is valid until the next git_*
+ *  call.
+ */
+const char *git_dir(void);
+
+/*
+ * git_branch: returns the name of the current git branch, read from the HEAD file of git_dir(),
+ *  or the abbreviated commit hash for a detached HEAD; or NULL if the current working directory
+ *  isn't in a git repository. The result is cached per directory until the HEAD file changes.
+ *  The returned string is valid until the next git_* call.
+ */
+const char *git_branch(void);
+
+/*
+ * git_dirty: returns whether or not the work tree of the repository the current working
+ *  directory is in has unstaged changes (like 'git diff --quiet'), without blocking: the
+ *  value is (re-)computed in a background thread when inotify reported a change of the index
+ *  or the work tree, so a change shows from the next call after that thread completed.
+ * @return: 1 iff there are unstaged changes, 0 if not, or -1 if unknown (not computed yet,
+ *  or not in a git work tree)
+ */
+int git_dirty(void);
+
+/*
+ * git_dirty_invalidate: let the next git_dirty() call scan the work tree again, even if
+ *  inotify didn't report any change (e.g. to measure the scan)
+ */
+void git_dirty_invalidate(void);
+
+/*
+ * git_dirty_wait: wait for the completion of the scan started by the last git_dirty() call,
+ *  if any, and return its result. Unlike the other git_* functions, this one may be called
+ *  from any thread.
+ */
+int git_dirty_wait(void);
+
+#endif //GIT_H_INCLUDED
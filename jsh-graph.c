@@ -0,0 +1,325 @@
+/* This file is part of jsh.
+ *
+ * jsh: A basic UNIX shell implementation in C
+ * Copyright (C) 2014 Jo Van Bulck <jo.vanbulck@student.kuleuven.be>
+ *
+ * jsh is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * jsh is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with jsh.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * jsh-graph.c: a runner for a graph of named steps with explicit dependencies. Each step runs as
+ *  soon as its dependencies succeeded, with at most a fixed nb of workers, so independent chains
+ *  of steps overlap and the graph completes in about the time of its longest chain, rather than
+ *  the sum of all its steps.
+ */
+
+#include "jsh-graph.h"
+#include "jsh-parse.h"
+#include "jsh-wait.h"
+#include "jsh-event.h"
+
+#define GRAPH_SEP       ':'     // separates the name, dependencies and cmd line of a step
+#define GRAPH_COMMENT   '#'     // a line starting with this char is ignored
+
+enum step_state {PENDING, RUNNING, SUCCEEDED, FAILED, SKIPPED};
+
+struct step {
+    char *name;
+    char *line;             // the cmd line
+    int *deps;              // index of each dependency in the steps array
+    int ndeps;
+    enum step_state state;
+    pid_t pid;              // iff RUNNING
+    long long start_ms;     // start time, iff launched
+    long long end_ms;       // end time, iff SUCCEEDED or FAILED
+    long long path_ms;      // duration of the longest chain of steps ending in this one
+    int path_prev;          // the previous step on that chain, or -1
+};
+
+// #################### helper function definitions ####################
+int read_graph(const char*, char**, struct step**);
+char *trim(char*);
+int find_step(struct step*, int, const char*);
+int *order_steps(struct step*, int);
+void report_graph(struct step*, int, int*, long long, int);
+void free_graph(char*, struct step*, int);
+
+int rungraph(const char *path, int workers) {
+    char *buf;
+    struct step *steps;
+    int i, j, n, st, *order;
+    if ((n = read_graph(path, &buf, &steps)) == -1)
+        return EXIT_FAILURE;
+    if ((order = order_steps(steps, n)) == NULL) {
+        free_graph(buf, steps, n);
+        return EXIT_FAILURE;
+    }
+    
+    waitset children;
+    waitset_init(&children);
+    // jsh itself also services the children watched by the event loop (e.g. queued tasks) meanwhile
+    if (!I_AM_FORK)
+        children.wake_fd = event_children_fd();
+    int nfailed = 0;
+    bool stop = false, by_zygote;
+    long long start_ms = now_ms();
+    fflush(stdout);
+    while (true) {
+        // launch the ready steps (in dependency order), as long as fewer than workers are
+        //  running; skip the steps with a failed dependency; stop on ^C
+        for (i = 0; i < n && !stop && children.nb < workers; i++) {
+            struct step *s = &steps[order[i]];
+            if (s->state != PENDING)
+                continue;
+            bool ready = true;
+            for (j = 0; j < s->ndeps && s->state == PENDING; j++)
+                if (steps[s->deps[j]].state == FAILED || steps[s->deps[j]].state == SKIPPED) {
+                    printerr("rungraph: skipping step '%s': dependency '%s' didn't succeed", s->name, steps[s->deps[j]].name);
+                    s->state = SKIPPED;
+                }
+                else
+                    ready = ready && steps[s->deps[j]].state == SUCCEEDED;
+            if (!ready || s->state != PENDING)
+                continue;
+            if (event_interrupted()) {
+                stop = true;
+                break;
+            }
+            printdebug("rungraph: launching step '%s': '%s'", s->name, s->line);
+            s->start_ms = now_ms();
+            if ((s->pid = spawn_line(s->line, &by_zygote)) == -1) {
+                s->state = FAILED;
+                s->end_ms = s->start_ms;
+                nfailed++;
+                continue;
+            }
+            s->state = RUNNING;
+            waitset_add(&children, s->pid, by_zygote);
+        }
+        if (children.nb == 0)
+            break;
+        // reap a completed step
+        pid_t pid = waitset_wait(&children, &st, -1);
+        if (pid == WAITSET_WOKEN)
+            event_reap_children();
+        stop = stop || pid == WAITSET_FAILED;
+        if (pid <= 0)
+            continue;
+        for (i = 0; i < n && !(steps[i].state == RUNNING && steps[i].pid == pid); i++);
+        if (i == n)
+            continue;
+        steps[i].end_ms = now_ms();
+        if (WIFEXITED(st) && WEXITSTATUS(st) == EXIT_SUCCESS)
+            steps[i].state = SUCCEEDED;
+        else {
+            steps[i].state = FAILED;
+            nfailed++;
+            if (WIFEXITED(st))
+                printerr("rungraph: step '%s' failed with exit status %d", steps[i].name, WEXITSTATUS(st));
+            else
+                printerr("rungraph: step '%s' was killed by signal %d", steps[i].name, WTERMSIG(st));
+        }
+    }
+    
+    int nsucceeded = 0;
+    for (i = 0; i < n; i++)
+        nsucceeded += (steps[i].state == SUCCEEDED);
+    report_graph(steps, n, order, now_ms() - start_ms, workers);
+    waitset_free(&children);
+    free(order);
+    free_graph(buf, steps, n);
+    return (nsucceeded == n)? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/*
+ * read_graph: read the steps from the graph file with the provided path into a malloc()ed
+ *  array, with the names and cmd lines pointing into the malloc()ed buffer with the file's content
+ * @return: the nb of steps, or -1 on failure (after printing an error message)
+ */
+int read_graph(const char *path, char **buf, struct step **steps) {
+    int fd = open(path, O_RDONLY);
+    if (fd == -1 || (*buf = read_fd(fd, NULL)) == NULL) {
+        printerrno("rungraph: couldn't read graph file '%s'", path);
+        if (fd != -1)
+            close(fd);
+        return -1;
+    }
+    close(fd);
+    
+    // first pass: split the lines into name, dependencies and cmd line
+    int i, n = 0, max = 0, lineno = 0;
+    char **deps = NULL, *line, *next, *word, *save;
+    *steps = NULL;
+    for (line = *buf; line != NULL; line = next) {
+        lineno++;
+        if ((next = strchr(line, '\n')) != NULL)
+            *next++ = '\0';
+        line = trim(line);
+        if (*line == '\0' || *line == GRAPH_COMMENT)
+            continue;
+        char *sep1 = strchr(line, GRAPH_SEP), *sep2 = sep1? strchr(sep1+1, GRAPH_SEP) : NULL;
+        if (sep2 == NULL) {
+            printerr("rungraph: %s:%d: expected 'name %c dependencies %c cmd line'", path, lineno, GRAPH_SEP, GRAPH_SEP);
+            goto fail;
+        }
+        *sep1 = *sep2 = '\0';
+        if (n == max) {
+            max = max? 2*max : 16;
+            *steps = realloc(*steps, sizeof(struct step) * max);
+            deps = realloc(deps, sizeof(char*) * max);
+        }
+        struct step *s = &(*steps)[n];
+        s->name = trim(line);
+        s->line = trim(sep2+1);
+        deps[n] = sep1+1;
+        s->ndeps = 0;
+        s->deps = malloc(sizeof(int) * (strlen(deps[n])/2 + 1));
+        s->state = PENDING;
+        s->path_prev = -1;
+        n++;
+        if (*s->name == '\0' || strpbrk(s->name, " \t") != NULL || *s->line == '\0') {
+            printerr("rungraph: %s:%d: expected a single word step name and a cmd line", path, lineno);
+            goto fail;
+        }
+        if (find_step(*steps, n-1, s->name) != -1) {
+            printerr("rungraph: %s:%d: duplicate step '%s'", path, lineno, s->name);
+            goto fail;
+        }
+    }
+    // second pass: resolve the dependencies, that may refer to steps further in the file
+    for (i = 0; i < n; i++)
+        for (word = strtok_r(deps[i], " \t", &save); word != NULL; word = strtok_r(NULL, " \t", &save)) {
+            int dep = find_step(*steps, n, word);
+            if (dep == -1) {
+                printerr("rungraph: %s: step '%s' depends on unknown step '%s'", path, (*steps)[i].name, word);
+                goto fail;
+            }
+            (*steps)[i].deps[(*steps)[i].ndeps++] = dep;
+        }
+    free(deps);
+    return n;
+
+fail:
+    free(deps);
+    free_graph(*buf, *steps, n);
+    return -1;
+}
+
+/*
+ * trim: strip the leading and trailing whitespace of the provided string, in place
+ * @return: a pointer to the first non-whitespace char of the string
+ */
+char *trim(char *s) {
+    s += strspn(s, " \t");
+    char *end = s + strlen(s);
+    while (end > s && strchr(" \t\r", end[-1]) != NULL)
+        end--;
+    *end = '\0';
+    return s;
+}
+
+/*
+ * find_step: returns the index of the step with the provided name among the first n steps,
+ *  or -1 if there is none
+ */
+int find_step(struct step *steps, int n, const char *name) {
+    int i;
+    for (i = 0; i < n; i++)
+        if (strcmp(steps[i].name, name) == 0)
+            return i;
+    return -1;
+}
+
+/*
+ * order_steps: returns a malloc()ed array with the indices of the steps in dependency order
+ *  (each step after all its dependencies; else in file order), or NULL if the dependencies
+ *  contain a cycle (after printing an error message)
+ */
+int *order_steps(struct step *steps, int n) {
+    int i, j, nordered = 0, *order = malloc(sizeof(int) * (n+1));
+    bool *ordered = calloc(n+1, sizeof(bool)), progress = true;
+    while (nordered < n && progress) {
+        progress = false;
+        for (i = 0; i < n; i++) {
+            for (j = 0; !ordered[i] && j < steps[i].ndeps && ordered[steps[i].deps[j]]; j++);
+            if (!ordered[i] && j == steps[i].ndeps) {
+                ordered[i] = progress = true;
+                order[nordered++] = i;
+            }
+        }
+    }
+    if (nordered < n) {
+        strbuf names = STRBUF_INIT;
+        for (i = 0; i < n; i++)
+            if (!ordered[i])
+                strbuf_appendf(&names, " %s", steps[i].name);
+        printerr("rungraph: dependency cycle between (or depending on) the steps:%s", names.buf);
+        strbuf_free(&names);
+        free(order);
+        order = NULL;
+    }
+    free(ordered);
+    return order;
+}
+
+/*
+ * report_graph: print the elapsed time, the nb of (un)succesful steps and the critical path
+ *  of the executed graph, i.e. the chain of dependent steps with the largest total duration,
+ *  on stderr
+ */
+void report_graph(struct step *steps, int n, int *order, long long elapsed_ms, int workers) {
+    int i, j, last = -1, counts[SKIPPED+1] = {0};
+    long long work_ms = 0;
+    for (i = 0; i < n; i++) {
+        struct step *s = &steps[order[i]];
+        counts[s->state]++;
+        if (s->state != SUCCEEDED && s->state != FAILED)
+            continue;
+        s->path_ms = 0;
+        for (j = 0; j < s->ndeps; j++)
+            if (steps[s->deps[j]].path_ms > s->path_ms) {
+                s->path_ms = steps[s->deps[j]].path_ms;
+                s->path_prev = s->deps[j];
+            }
+        work_ms += s->end_ms - s->start_ms;
+        s->path_ms += s->end_ms - s->start_ms;
+        if (last == -1 || s->path_ms > steps[last].path_ms)
+            last = order[i];
+    }
+    fprintf(stderr, "rungraph: %d steps in %.2fs (%.2fs of work on %d worker%s): %d succeeded, %d failed, %d skipped, %d not run\n",
+        n, elapsed_ms / 1000.0, work_ms / 1000.0, workers, (workers == 1)? "" : "s", counts[SUCCEEDED], counts[FAILED], counts[SKIPPED], counts[PENDING]);
+    if (last == -1)
+        return;
+    
+    // print the critical path from its first step on
+    int nb, *path = malloc(sizeof(int) * n);
+    for (nb = 0, i = last; i != -1; i = steps[i].path_prev)
+        path[nb++] = i;
+    fprintf(stderr, "rungraph: critical path %.2fs:", steps[last].path_ms / 1000.0);
+    for (i = nb-1; i >= 0; i--)
+        fprintf(stderr, " %s (%.2fs)%s", steps[path[i]].name, (steps[path[i]].end_ms - steps[path[i]].start_ms) / 1000.0, i? " ->" : "");
+    fprintf(stderr, "\n");
+    free(path);
+}
+
+/*
+ * free_graph: free the file buffer and the first n steps of the steps array
+ */
+void free_graph(char *buf, struct step *steps, int n) {
+    int i;
+    for (i = 0; i < n; i++)
+        free(steps[i].deps);
+    free(steps);
+    free(buf);
+}
@@ -0,0 +1,37 @@
+/* This file is part of jsh.
+ *
+ * jsh: A basic UNIX shell implementation in C
+ * Copyright (C) 2014 Jo Van Bulck <jo.vanbulck@student.kuleuven.be>
+ *
+ * jsh is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * jsh is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with jsh.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GRAPH_H_INCLUDED
+#define GRAPH_H_INCLUDED
+/* ^^ these are the include guards */
+
+#include "jsh-common.h"
+
+/*
+ * rungraph: run the steps of the graph file with the provided path, keeping at most workers
+ *  steps running. Each non-empty line of the file that doesn't start with '#' is a step:
+ *      name : dependency ... : cmd line
+ *  A step is launched as soon as all its dependencies succeeded; the steps that depend on a
+ *  failed step are skipped. The duration of each step and the critical path (the chain of
+ *  dependent steps that took the longest) are reported on stderr at the end.
+ * @return: EXIT_SUCCESS iff all steps succeeded, else EXIT_FAILURE
+ */
+int rungraph(const char*, int);
+
+#endif //GRAPH_H_INCLUDED
@@ -32,10 +32,17 @@
  *              cmd
  *
  * cmd    :=    cmd | cmd           // cmd is the unit of truth value evaluation
+ *              (expr) | cmd        // a bracket group that is piped or redirected is a comd,
+ *              cmd | (expr)        //  executed by a forked jsh
  *              cmd >> path         // note: pipe redirection get priority over explicit redirection
  *              cmd 2> path
  *              cmd > path
  *              cmd < path
+ *              cmd << word         // here-document: the next lines, up to a line 'word'
+ *              cmd <<- word        //  idem, with leading tabs stripped from those lines
+ *              cmd <<< word        // here-string: word followed by a newline
+ *              cmd <(expr)         // process substitution: replaced by a /dev/fd path to a pipe
+ *              cmd >(expr)         //  from (to) expr, that runs concurrently in a forked jsh
  *              cmd &               *TODO
  *              comd
  *
@@ -60,18 +67,65 @@
  */
 
 #include "jsh-parse.h"
+#include "jsh-zygote.h"
+#include "jsh-wait.h"
+#include "jsh-event.h"
+#include "jsh-capture.h"
+#include "jsh-prompt.h"
+#include <signal.h>
 
+#define BATCH_HEADROOM      2048    // bytes of ARG_MAX left unused by the batch built_in, like xargs
+#define ARG_SIZE(arg)       (strlen(arg) + 1 + sizeof(char*))   // bytes an argument takes in the exec'ed argv
 #define RESOLVE_TRUTH_VAL(rv) ((rv == EXIT_SUCCESS)? 'T' : 'F') // note: 'T' and 'F' are built-ins
+#define HEREDOC_ALLOC_UNIT  256     // unit of (re-)allocation for a here-document body
+#define SIMPLE_CMD_SPECIAL_CHARS "|;&<>()#\"\\'~"  // a cmd line without these is launched by spawn_line() as is
+#define IS_PROCSUB(arg)     (procsub_length(arg) > 0 && (arg)[procsub_length(arg)] == '\0')
+#define IS_GROUP(arg)       (group_length(arg) > 0 && (arg)[group_length(arg)] == '\0')
+
+/*
+ * A here-document of an inputline; parseline() reads the bodies before executing the line
+ */
+struct heredoc {
+    char *delim;        // the delimiting word
+    bool strip_tabs;    // whether or not leading tabs are stripped from the body lines ('<<-')
+    bool taken;         // whether or not a comd already redirected its stdin to this heredoc
+    char *body;         // the body lines, including their newlines
+    size_t length;      // the length of the body
+    size_t size;        // the allocated size of the body
+};
+
+struct heredoc_line {
+    char *line;             // the inputline to be executed
+    struct heredoc *docs;   // the here-documents of the line, in order of appearance
+    int nb;                 // the nb of here-documents
+    int filled;             // the nb of here-documents whose body is completely read
+};
+
+static struct heredoc_line reading = {NULL, NULL, 0, 0};   // the line whose heredocs are being read
+static struct heredoc_line *running = NULL;                 // the line being executed, if any
 
 // #################### helper function definitions ####################
 comd *createcomd(char**);
 void freecomdlist(comd*);
 int parsecmd(char**, int);
 int execute(comd*, int);
-void redirectstreams(comd*, int, int);
+int execute_deadline(comd*, int, long, long);
+void give_terminal_to(pid_t);
+void join_process_group(pid_t, bool);
+long arg_space(void);
+pid_t spawn(comd*, int, bool*);
+char *replace_all(const char*, const char*, const char*);
+bool should_capture(comd*);
+int group_length(const char*);
+int procsub_length(const char*);
+int nested_length(const char*);
+int scan_heredocs(char*, struct heredoc_line*);
+void free_heredocs(struct heredoc_line*);
+struct heredoc *take_heredoc(char*);
 int exec_built_in(comd*, int, int);
 extern int is_built_in(comd*);
 extern int parse_built_in(comd*, int);
+extern int built_in_flags(int);
 
 /*
  * createcomd: returns a pointer to a newly created comd struct, 
@@ -92,6 +146,9 @@ comd *createcomd(char **cmd) {
     ret->outf = NULL;
     ret->errf = NULL;
     ret->append_out = 0;
+    ret->heredoc = NULL;
+    ret->heredoc_length = 0;
+    ret->herestring = false;
     ret->next = NULL;
     return ret;
 }
@@ -113,12 +170,160 @@ void freecomdlist(comd *list) {
  * TODO also take aliases etc into account
  */
 int parse_from_file(char *line) {
+    if (strcmp(line, "\n") == 0)
+        return EXIT_SUCCESS;    // line separator passed by parsestream()
+    if (heredoc_pending())
+        return parseline(line); // here-document lines are passed verbatim
     char *resolved = resolvealiases(line);
-    int rv = parseexpr(resolved);
+    int rv = parseline(resolved);
     free(resolved);
     return rv;
 }
 
+/*
+ * parseline: parses an inputline with parseexpr(), after reading the bodies of its here-documents
+ *  (if any) from the next lines, that should be passed verbatim to subsequent parseline() calls.
+ *  A NULL line (EOF) ends the pending here-documents.
+ *  returns HEREDOC_PENDING iff more lines are needed; else the exit status of the executed line
+ */
+int parseline(char *line) {
+    if (!heredoc_pending()) {
+        if (line == NULL)
+            return EXIT_SUCCESS;
+        int nb = scan_heredocs(line, &reading);
+        if (nb == 0)
+            return parseexpr(line);
+        if (nb == -1)
+            return EXIT_FAILURE;
+        reading.line = strclone(line);
+        return HEREDOC_PENDING;
+    }
+    
+    // add the line to the body of the current here-document, unless it's the delimiter
+    struct heredoc *doc = &reading.docs[reading.filled];
+    if (line == NULL)
+        printerr("here-document delimited by end-of-file (wanted '%s')", doc->delim);
+    else {
+        if (doc->strip_tabs)
+            line += strspn(line, "\t");
+        if (strcmp(line, doc->delim) == 0)
+            reading.filled++;
+        else {
+            size_t len = strlen(line);
+            if (doc->length + len + 1 > doc->size) {
+                doc->size = ((doc->length + len + 1) / HEREDOC_ALLOC_UNIT + 1) * HEREDOC_ALLOC_UNIT;
+                doc->size = (doc->size < 2 * doc->length)? 2 * doc->length : doc->size;
+                if (!(doc->body = realloc(doc->body, doc->size))) {
+                    printerrno("Running out of memory. Exiting");
+                    exit(EXIT_FAILURE);
+                }
+            }
+            memcpy(doc->body + doc->length, line, len);
+            doc->length += len;
+            doc->body[doc->length++] = '\n';
+        }
+        if (reading.filled < reading.nb)
+            return HEREDOC_PENDING;
+    }
+    
+    // all bodies are read: execute the line (that could source files with heredocs itself)
+    struct heredoc_line *prev = running, cur = reading;
+    memset(&reading, 0, sizeof(reading));
+    running = &cur;
+    int rv = parseexpr(cur.line);
+    running = prev;
+    free_heredocs(&cur);
+    return rv;
+}
+
+/*
+ * heredoc_pending: returns whether or not parseline() is reading here-document bodies
+ */
+bool heredoc_pending(void) {
+    return (reading.line != NULL);
+}
+
+/*
+ * heredoc_discard: discards the line whose here-document bodies are being read, if any
+ */
+void heredoc_discard(void) {
+    free_heredocs(&reading);
+    memset(&reading, 0, sizeof(reading));
+}
+
+/*
+ * scan_heredocs: adds the here-document redirections ('<< word' and '<<- word') in the provided
+ *  inputline to the provided heredoc_line. Quoted parts, comments and process substitutions
+ *  are skipped, like parseexpr() does; quotes in the delimiting word are removed.
+ *  returns the nb of here-documents found, or -1 on a parse error
+ */
+int scan_heredocs(char *line, struct heredoc_line *hl) {
+    int i, k;
+    bool inquotes = false;
+    for (i = 0; line[i] != '\0'; i++) {
+        bool tokenstart = (i == 0 || line[i-1] == ' ');
+        if (line[i] == '\\' && line[i+1] != '\0')
+            i++;
+        else if (line[i] == '"')
+            inquotes = !inquotes;
+        else if (inquotes)
+            continue;
+        else if (line[i] == '#')
+            break;
+        else if (tokenstart && (k = procsub_length(line+i)) > 0)
+            i += k-1;
+        else if (tokenstart && strncmp(line+i, "<<", 2) == 0 && line[i+2] != '<') {
+            bool strip_tabs = (line[i+2] == '-');
+            k = i + 2 + strip_tabs;
+            k += strspn(line+k, " ");
+            int len = strcspn(line+k, " ;|&()#");
+            if (len == 0) {
+                printerr("parse error: no delimiter specified after here-document operator '<<'");
+                free_heredocs(hl);
+                memset(hl, 0, sizeof(*hl));
+                return -1;
+            }
+            hl->docs = realloc(hl->docs, sizeof(struct heredoc) * (hl->nb+1));
+            struct heredoc *doc = &hl->docs[hl->nb++];
+            memset(doc, 0, sizeof(*doc));
+            doc->delim = strndup(line+k, len);
+            remove_char(doc->delim, '"');
+            remove_char(doc->delim, '\'');
+            doc->strip_tabs = strip_tabs;
+            i = k + len - 1;
+        }
+    }
+    return hl->nb;
+}
+
+/*
+ * free_heredocs: free()s the here-documents of the provided heredoc_line and its line
+ */
+void free_heredocs(struct heredoc_line *hl) {
+    int i;
+    for (i = 0; i < hl->nb; i++) {
+        free(hl->docs[i].delim);
+        free(hl->docs[i].body);
+    }
+    free(hl->docs);
+    free(hl->line);
+}
+
+/*
+ * take_heredoc: returns the first here-document of the line being executed with the provided
+ *  delimiting word (quotes are removed) that wasn't taken yet, or NULL if there is none
+ */
+struct heredoc *take_heredoc(char *delim) {
+    int i;
+    remove_char(delim, '\'');
+    for (i = 0; running != NULL && i < running->nb; i++)
+        if (!running->docs[i].taken && strcmp(running->docs[i].delim, delim) == 0) {
+            running->docs[i].taken = true;
+            return &running->docs[i];
+        }
+    return NULL;
+}
+
 /*
  * parseexpr: parses the '\0' terminated expr string recursivly, according to the 'expr' grammar.
  * returns exit status (EXIT_SUCCESS || !EXIT_SUCCESS) of executed expression
@@ -152,6 +357,9 @@ int parseexpr(char *expr) {
         else if (expr[i] == '"' && (i == 0 || expr[i-1] != '\\')) {
             inquotes = inquotes?false:true;
         }
+        else if ((i == 0 || expr[i-1] == ' ') && (k = nested_length(expr+i)) > 0) {
+            i += k-1;   // the expr of a bracket group (stage) or process substitution is parsed by a forked jsh
+        }
         else if (expr[i] == ';') {
             expr[i] = '\0';
             parseexpr(expr);
@@ -209,13 +417,18 @@ int resolvebrackets(char *expr, int length) {
         printerr("parse errror: unbalanced parenthesis when evaluating '%s'", expr);
         return EXIT_FAILURE;
     }
+    
+    // 2. a group that is piped or redirected is a comd, executed by a forked jsh (see execute_deadline())
+    char *after = r + 1 + strspn(r+1, " ");
+    if ((*after == '|' && after[1] != '|') || *after == '<' || *after == '>' || strncmp(after, "2>", 2) == 0)
+        return -1;
         
-    // 2. (recursively) parse the expression between brackets
+    // 3. (recursively) parse the expression between brackets
     *r = '\0';
     printdebug("resolvebrackets: now evaluating '%s'", l+1);
     rv = parseexpr(l+1);
         
-    /* 3. parse the remainder of the expression, replacing the evaluated subexpression with 
+    /* 4. parse the remainder of the expression, replacing the evaluated subexpression with 
     its built-in truth value (T | F), using memmove for overlapping memory
         [--> no buf overflow, since at least 2 chars '(' and ')' are replaced with a single 'T' or 'F' char]
     */
@@ -264,13 +477,17 @@ int splitexpr(char *expr, char ***ret) {
                 index++; \
             }
             
+        int k;
+        if (ch == expr + i && (k = nested_length(expr+i)) > 0) {
+            i += k-1;   // a bracket group or process substitution is a single token, split by a forked jsh
+            continue;
+        }
         CHK_ESCAPING(i)
         if (expr[i] == '"') { //TODO TODO doc -> protect content
             expr[i] = '\0';
             if (ch < expr + i)
                 curcmd[j++] = ch; //TODO realloc??
             ch = expr + i + 1;
-            int k;
             bool found = false;
             for (k=i+1; k < length && !found; k++) {
                 CHK_ESCAPING(k)
@@ -328,10 +545,43 @@ int parsecmd(char **cmd, int length) {
             pipeline_tail = new;
             nbpipes++;
         }
+        else if (IS_PROCSUB(cmd[i])) {
+            continue;   // not a redirection, but an argument; see execute_deadline()
+        }
+        else if (strncmp(cmd[i], "<<<", 3) == 0) {
+            char *word = cmd[i] + 3;
+            cmd[i] = NULL;
+            if (*word == '\0') {
+                CHK_FILE("<<<")
+                word = cmd[++i];
+            }
+            pipeline_tail->inf = NULL;
+            pipeline_tail->heredoc = word;
+            pipeline_tail->heredoc_length = strlen(word);
+            pipeline_tail->herestring = true;
+        }
+        else if (strncmp(cmd[i], "<<", 2) == 0) {
+            char *delim = cmd[i] + 2 + (cmd[i][2] == '-');
+            cmd[i] = NULL;
+            if (*delim == '\0') {
+                CHK_FILE("<<")
+                delim = cmd[++i];
+            }
+            struct heredoc *doc = take_heredoc(delim);
+            if (doc == NULL) {
+                printerr("parse error: no here-document body read for delimiter '%s'", delim);
+                return EXIT_FAILURE;
+            }
+            pipeline_tail->inf = NULL;
+            pipeline_tail->heredoc = doc->body? doc->body : "";
+            pipeline_tail->heredoc_length = doc->length;
+            pipeline_tail->herestring = false;
+        }
         else if (*cmd[i] == '<') {
             CHK_FILE("<")
             cmd[i++] = NULL;
             pipeline_tail->inf = cmd[i];
+            pipeline_tail->heredoc = NULL;
         }
         else if (strncmp(cmd[i], ">>", 2) == 0) {
             CHK_FILE(">>")
@@ -355,7 +605,7 @@ int parsecmd(char **cmd, int length) {
 }
 
 /*
- * execute: execute a list of comds as a pipeline, using fork and exec.
+ * execute: execute a list of comds as a pipeline, using fork and exec (or the zygote helper, if enabled).
  *  specified number of pipes npipes  = (length of pipeline - 1)
  *  returns the exit status (EXIT_SUCCESS || !EXIT_SUCCESS) of the last process in the pipeline
  *
@@ -363,6 +613,369 @@ int parsecmd(char **cmd, int length) {
  *          e.g. ls > out | less : ls stdout will *only* be directed to less
  */
 int execute(comd *pipeline, int npipes) {
+    return execute_deadline(pipeline, npipes, -1, -1);
+}
+
+/*
+ * timeout_cmd: execute the NULL terminated cmd array in a new process group, that is sent
+ *  SIGTERM after timeout_ms and SIGKILL kill_ms after that (iff kill_ms >= 0)
+ *  returns TIMEOUT_STATUS iff the timeout expired; else the exit status of the command
+ */
+int timeout_cmd(char **cmd, long timeout_ms, long kill_ms) {
+    return execute_deadline(createcomd(cmd), 0, timeout_ms, kill_ms);
+}
+
+/*
+ * execute_cmd: execute the NULL terminated cmd array as a single comd, with execute()
+ *  returns the exit status of the command
+ */
+int execute_cmd(char **cmd) {
+    return execute(createcomd(cmd), 0);
+}
+
+/*
+ * batch_cmd: execute the NULL terminated cmd array, splitting the arguments after its head
+ *  over as many invocations as needed to stay within ARG_MAX, at most max_procs in parallel.
+ *  The head is everything before the first ':::', which is dropped; else everything up to and
+ *  including the first '--'; else just cmd[0].
+ *  returns the status of the single invocation if one sufficed; else EXIT_SUCCESS iff all
+ *  invocations succeeded and BATCH_FAILED_STATUS (123) otherwise
+ */
+int batch_cmd(char **cmd, int max_procs) {
+    int i, n, head, first;
+    for (n = 0; cmd[n] != NULL; n++);
+    
+    // the head is part of each batch: up to ':::' (a batch-only separator) or including '--'
+    for (head = 1; head < n && strcmp(cmd[head], ":::") != 0; head++);
+    first = head + 1;
+    if (head == n) {
+        for (head = 1; head < n && strcmp(cmd[head], "--") != 0; head++);
+        head = first = (head < n)? head+1 : 1;
+    }
+    long space = arg_space(), headsize = 0;
+    for (i = 0; i < head; i++)
+        headsize += ARG_SIZE(cmd[i]);
+    
+    char **argv = malloc(sizeof(char*) * (n+1));
+    memcpy(argv, cmd, sizeof(char*) * head);
+    waitset children;
+    waitset_init(&children);
+    // jsh itself also services the children watched by the event loop (e.g. queued tasks) meanwhile
+    if (!I_AM_FORK)
+        children.wake_fd = event_children_fd();
+    int next = first, nbatches = 0, st, status = EXIT_SUCCESS;
+    bool failed = false, stop = false, by_zygote;
+    do {
+        // launch the next batches, as long as fewer than max_procs are running; stop on ^C
+        while (!stop && (next < n || nbatches == 0) && children.nb < max_procs) {
+            if (event_interrupted()) {
+                failed = stop = true;
+                break;
+            }
+            long size = headsize;
+            for (i = head; next < n && (i == head || size + ARG_SIZE(cmd[next]) <= space); i++, next++) {
+                size += ARG_SIZE(cmd[next]);
+                argv[i] = cmd[next];
+            }
+            argv[i] = NULL;
+            printdebug("batch: launching batch %d with %d arguments (%ld bytes)", nbatches+1, i-head, size);
+            
+            comd *c = createcomd(argv);
+            pid_t pid = spawn(c, -1, &by_zygote);  // note: argv is reused for the next batch; the child has a copy
+            free(c);
+            nbatches++;
+            if (pid == -1) {
+                status = EXIT_FAILURE;
+                failed = stop = true;
+                break;
+            }
+            waitset_add(&children, pid, by_zygote);
+        }
+        // wait for any batch to complete
+        pid_t pid = waitset_wait(&children, &st, -1);
+        if (pid == WAITSET_WOKEN)
+            event_reap_children();
+        else if (pid == WAITSET_FAILED) {
+            status = EXIT_FAILURE;
+            failed = stop = true;
+        }
+        else if (pid > 0) {
+            status = WIFEXITED(st)? WEXITSTATUS(st) : 128 + WTERMSIG(st);
+            failed = failed || status != EXIT_SUCCESS;
+        }
+    } while (children.nb > 0 || (next < n && !stop));
+    
+    waitset_free(&children);
+    free(argv);
+    if (nbatches == 1)
+        return status;
+    return failed? BATCH_FAILED_STATUS : EXIT_SUCCESS;
+}
+
+/*
+ * parallel_cmd: execute the NULL terminated cmd template once per input, with its '{}' replaced by
+ *  the input (or the input appended), running at most max_procs jobs at a time. Iff group, the
+ *  output of each job is buffered and written out when it completes.
+ *  returns the nb of failed jobs, capped at PARALLEL_MAX_FAILED (101)
+ */
+int parallel_cmd(char **cmd, char **inputs, int ninputs, int max_procs, bool group) {
+    int i, n, next = 0, njobs = 0, nfailed = 0, st;
+    for (n = 0; cmd[n] != NULL; n++);
+    bool has_placeholder = false;
+    for (i = 1; i < n; i++)
+        has_placeholder = has_placeholder || strstr(cmd[i], PARALLEL_PLACEHOLDER) != NULL;
+    
+    // the running jobs: pid and output file (iff group)
+    int max = (max_procs < ninputs)? max_procs : ninputs;
+    pid_t *pids = malloc(sizeof(pid_t) * max);
+    int *outfds = malloc(sizeof(int) * max);
+    char **argv = malloc(sizeof(char*) * (n+2));
+    waitset children;
+    waitset_init(&children);
+    // jsh itself also services the children watched by the event loop (e.g. queued tasks) meanwhile
+    if (!I_AM_FORK)
+        children.wake_fd = event_children_fd();
+    bool stop = false, by_zygote;
+    while (children.nb > 0 || (next < ninputs && !stop)) {
+        // launch the next jobs, as long as fewer than max_procs are running; stop on ^C
+        while (!stop && next < ninputs && children.nb < max_procs) {
+            if (event_interrupted()) {
+                nfailed += ninputs - next;
+                stop = true;
+                break;
+            }
+            // instantiate the template: replace '{}' by the input, or append the input
+            argv[0] = cmd[0];
+            for (i = 1; i < n; i++)
+                argv[i] = replace_all(cmd[i], PARALLEL_PLACEHOLDER, inputs[next]);
+            if (!has_placeholder)
+                argv[i++] = strclone(inputs[next]);
+            argv[i] = NULL;
+            int outfd = group? memory_file() : -1;
+            if (group && outfd == -1)
+                printerrno("parallel: couldn't create an output file; not grouping the output of job %d", next+1);
+            printdebug("parallel: launching job %d: '%s'", next+1, inputs[next]);
+            
+            comd *c = createcomd(argv);
+            pid_t pid = spawn(c, outfd, &by_zygote);
+            free(c);
+            for (i = 1; argv[i] != NULL; i++)
+                free(argv[i]);
+            next++;
+            if (pid == -1) {
+                if (outfd != -1)
+                    close(outfd);
+                nfailed++;
+                continue;
+            }
+            pids[njobs] = pid;
+            outfds[njobs++] = outfd;
+            waitset_add(&children, pid, by_zygote);
+        }
+        // reap a completed job and write out its output, if grouped
+        pid_t pid = waitset_wait(&children, &st, -1);
+        if (pid == WAITSET_WOKEN)
+            event_reap_children();
+        if (pid == WAITSET_FAILED && !stop) {
+            nfailed += ninputs - next;
+            stop = true;
+        }
+        if (pid <= 0)
+            continue;
+        if (!WIFEXITED(st) || WEXITSTATUS(st) != EXIT_SUCCESS)
+            nfailed++;
+        for (i = 0; i < njobs && pids[i] != pid; i++);
+        if (i == njobs)
+            continue;
+        if (outfds[i] != -1) {
+            if (lseek(outfds[i], 0, SEEK_SET) == -1 || copy_fd(outfds[i], STDOUT_FILENO) != EXIT_SUCCESS)
+                printerrno("parallel: couldn't write the output of process %d", pid);
+            close(outfds[i]);
+        }
+        pids[i] = pids[--njobs];
+        outfds[i] = outfds[njobs];
+    }
+    
+    waitset_free(&children);
+    free(pids);
+    free(outfds);
+    free(argv);
+    return (nfailed < PARALLEL_MAX_FAILED)? nfailed : PARALLEL_MAX_FAILED;
+}
+
+/*
+ * replace_all: returns a malloc()ed copy of the provided string str, with all occurences of
+ *  the provided pattern replaced by the provided replacement string
+ */
+char *replace_all(const char *str, const char *pattern, const char *replacement) {
+    int count = 0;
+    size_t plen = strlen(pattern), rlen = strlen(replacement);
+    const char *p;
+    for (p = str; (p = strstr(p, pattern)) != NULL; p += plen)
+        count++;
+    char *ret = malloc(strlen(str) + count * (rlen - plen) + 1), *dst = ret;
+    for (p = str; (p = strstr(str, pattern)) != NULL; str = p + plen) {
+        memcpy(dst, str, p - str);
+        dst += p - str;
+        memcpy(dst, replacement, rlen);
+        dst += rlen;
+    }
+    strcpy(dst, str);
+    return ret;
+}
+
+/*
+ * should_capture: returns whether or not the output of the provided pipeline should be captured:
+ *  iff its last cmd isn't a built_in and it doesn't contain built_ins that read the capture buffer
+ */
+bool should_capture(comd *pipeline) {
+    comd *cur;
+    int built_in = -1;
+    for (cur = pipeline; cur != NULL; cur = cur->next)
+        if ((built_in = is_built_in(cur)) != -1 && (built_in_flags(built_in) & BUILT_IN_NO_CAPTURE))
+            return false;
+    return (built_in == -1);
+}
+
+/*
+ * group_length: returns the length of the bracket group '(expr)' at the start of the provided
+ *  string, up to and including the matching ')'; or 0 if there is none
+ */
+int group_length(const char *s) {
+    if (*s != '(')
+        return 0;
+    int i, depth = 0;
+    bool inquotes = false;
+    for (i = 0; s[i] != '\0'; i++) {
+        if (s[i] == '\\' && s[i+1] != '\0')
+            i++;
+        else if (s[i] == '"')
+            inquotes = !inquotes;
+        else if (inquotes)
+            continue;
+        else if (s[i] == '(')
+            depth++;
+        else if (s[i] == ')' && --depth == 0)
+            return i+1;
+    }
+    return 0;
+}
+
+/*
+ * procsub_length: returns the length of the process substitution '<(expr)' or '>(expr)' at the
+ *  start of the provided string, up to and including the matching ')'; or 0 if there is none
+ */
+int procsub_length(const char *s) {
+    int length;
+    if ((*s != '<' && *s != '>') || (length = group_length(s+1)) == 0)
+        return 0;
+    return length+1;
+}
+
+/*
+ * nested_length: returns the length of the bracket group or process substitution at the start
+ *  of the provided string, or 0 if there is none
+ */
+int nested_length(const char *s) {
+    return (*s == '(')? group_length(s) : procsub_length(s);
+}
+
+/*
+ * arg_space: returns the nb of bytes available for the argv of an exec'ed command:
+ *  ARG_MAX minus the space taken by the environment and some headroom
+ */
+long arg_space(void) {
+    extern char **environ;
+    char **env;
+    long space = sysconf(_SC_ARG_MAX);
+    if (space <= 0)
+        space = _POSIX_ARG_MAX;
+    for (env = environ; *env != NULL; env++)
+        space -= ARG_SIZE(*env);
+    return space - BATCH_HEADROOM;
+}
+
+/*
+ * spawn: launch the provided comd, by the zygote helper if any; else fork and exec it
+ * @arg stdoutfd : file descriptor for stdout, or -1
+ * @arg by_zygote: set to true iff the zygote launched the process
+ * @return: the pid of the launched process or -1 on failure
+ */
+pid_t spawn(comd *c, int stdoutfd, bool *by_zygote) {
+    pid_t pid;
+    *by_zygote = USE_ZYGOTE && (pid = zygote_spawn(c, -1, stdoutfd)) != -1;
+    if (*by_zygote)
+        return pid;
+    
+    if ((pid = fork()) == -1)
+        printerrno("Creation of child process failed");
+    else if (pid == 0) {
+        I_AM_FORK = 1;
+        event_restore_sigmask();
+        redirectstreams(c, -1, stdoutfd);
+        execvp(*c->cmd, c->cmd);
+        print_exec_error(*c->cmd);
+        exit_fork(EXIT_FAILURE);
+    }
+    return pid;
+}
+
+/*
+ * spawn_line: launch the provided cmd line without waiting for it. A simple command (only words,
+ *  that doesn't start with an alias or built_in, and no global aliases defined) is launched by spawn(),
+ *  so by the zygote helper if any; any other line by a forked jsh that parses it.
+ * @arg by_zygote: set to true iff the zygote launched the process
+ * @return: the pid of the launched process or -1 on failure
+ */
+pid_t spawn_line(const char *line, bool *by_zygote) {
+    pid_t pid;
+    char *copy = strclone(line), *word;
+    if (line[strcspn(line, SIMPLE_CMD_SPECIAL_CHARS)] == '\0') {
+        int n = 0;
+        char **argv = malloc(sizeof(char*) * (strlen(line)/2 + 2));
+        for (word = strtok(copy, " \t"); word != NULL; word = strtok(NULL, " \t"))
+            argv[n++] = word;
+        argv[n] = NULL;
+        comd *c = createcomd(argv);
+        if (n > 0 && !alias_exists(*argv) && !has_global_aliases() && is_built_in(c) == -1) {
+            pid = spawn(c, -1, by_zygote);
+            free(c);
+            free(argv);
+            free(copy);
+            return pid;
+        }
+        free(c);
+        free(argv);
+        strcpy(copy, line);
+    }
+    
+    *by_zygote = false;
+    if ((pid = fork()) == -1)
+        printerrno("Creation of child process failed");
+    else if (pid == 0) {
+        I_AM_FORK = 1;
+        event_restore_sigmask();
+        exit_fork(parse_from_file(copy));
+    }
+    free(copy);
+    return pid;
+}
+
+void print_exec_error(char *cmd) {
+    int err = errno;
+    printerrno("couldn't execute command '%s'", cmd);
+    if (err == E2BIG)
+        printerr("argument list too long; use 'batch %s [args] ::: ...' to split it over several invocations", cmd);
+}
+
+/*
+ * execute_deadline: execute() helper function, with an optional deadline: iff timeout_ms >= 0,
+ *  the pipeline gets its own process group, that is sent SIGTERM when the deadline expires
+ *  and SIGKILL kill_ms later (iff kill_ms >= 0).
+ *  Waiting for the children is done on pidfds with poll(), so no helper process is needed.
+ *  returns TIMEOUT_STATUS iff the deadline expired; else the exit status of the last process
+ */
+int execute_deadline(comd *pipeline, int npipes, long timeout_ms, long kill_ms) {
     int i, pfds[npipes*2];
     // 0. create n pipes and store the file descriptors
     for (i = 0; i < npipes; i++)
@@ -375,34 +988,130 @@ int execute(comd *pipeline, int npipes) {
             if (pfds[k] != -1 && close(pfds[k]) == -1) \
                 printerrno("couldn't close pipefd %d", pfds[k]);
     #define CLOSE_PREV_PIPE \
-        if (stdoutfd != -1 && close(stdoutfd) == -1) \
-            printerrno("couldn't close writing end with pipefd %d", pfds[k]); \
-        else \
-            pfds[j+1] = -1; // to indicate this side is closed
+        if (stdoutfd != -1) { \
+            if (close(stdoutfd) == -1) \
+                printerrno("couldn't close writing end with pipefd %d", stdoutfd); \
+            if (i < npipes) \
+                pfds[j+1] = -1; /* to indicate this side is closed */ \
+            else \
+                capfds[1] = -1; \
+        }
+    #define CLOSE_PROCSUBS \
+        for (k = 0; k < nsubs; k++) \
+            close(subfds[k]);
+    
+    // in capture mode, the last cmd writes to a pipe that jsh passes through to stdout
+    int capfds[2] = {-1, -1};
+    if (CAPTURE && timeout_ms < 0 && !I_AM_FORK && should_capture(pipeline)) {
+        if (pipe(capfds) == 0) {
+            // note: close-on-exec, so that only the last cmd holds the writing end (as stdout)
+            fcntl(capfds[0], F_SETFD, FD_CLOEXEC);
+            fcntl(capfds[1], F_SETFD, FD_CLOEXEC);
+        }
+        else
+            printerrno("capture: couldn't create pipe; not capturing");
+    }
     
     comd *cur = pipeline;
-    int j, k, status = 0, nbchildren = 0;
+    int j, k, status = 0;
+    bool ran_sudo = false;              // whether or not the pipeline has a 'sudo' cmd
+    waitset children;                   // the launched child processes
+    waitset_init(&children);
+    pid_t last_child = -1;              // pid of the last launched child process
+    pid_t pgid = 0;                     // process group of the pipeline iff a deadline is set
+    // a process group with a deadline gets the terminal, so ^C and tty reads keep working
+    bool own_terminal = (timeout_ms >= 0 && IS_INTERACTIVE && tcgetpgrp(STDIN_FILENO) == getpgrp());
+    pid_t pid;
     /* 1. fork nbchildren = (npipes + 1 - nbuiltins) child processes and connect them to the pipes
         NOTE: each iteration: close the writing end of the prev pipe to indicate the parent process (jsh)
         won't use it anymore; otherwise, the next process (built_in) in the pipeline won't receive the EOF...*/
     for (i = 0, j = 0; i <= npipes; i++, j+=2, cur = cur->next) {
         /**** pipe stdin iff not first cmd; stdout iff not last cmd ****/
         int stdinfd = (i > 0)? pfds[j-2] : -1;
-        int stdoutfd = (i < npipes)? pfds[j+1] : -1;
+        int stdoutfd = (i < npipes)? pfds[j+1] : capfds[1];
         
         //TODO TODO
         //*cur->cmd = resolvealiases(*cur->cmd);
         
-        /**** try to execute cur as a built_in ****/
-        if ((status = exec_built_in(cur, stdinfd, stdoutfd)) != -1) {
+        /**** start the process substitutions in cur's arguments and redirections, if any, concurrently with cur ****/
+        int built_in = is_built_in(cur);
+        ran_sudo |= (*cur->cmd != NULL && strcmp(*cur->cmd, "sudo") == 0);
+        int n = 0, nsubs = 0, subfds[cur->length+3];
+        char subpaths[cur->length+3][sizeof("/dev/fd/") + 10];
+        char **args[cur->length+3];
+        if (built_in == -1 || !(built_in_flags(built_in) & BUILT_IN_OWN_PROCSUB))
+            for (; cur->cmd[n] != NULL; n++)
+                args[n] = &cur->cmd[n];
+        args[n++] = &cur->inf;
+        args[n++] = &cur->outf;
+        args[n++] = &cur->errf;
+        while (n-- > 0) {
+            char *arg = *args[n];
+            if (arg == NULL || !IS_PROCSUB(arg))
+                continue;
+            int sfds[2];
+            bool input = (*arg == '<');     // whether cur reads the output of the expr
+            if (pipe(sfds) < 0) {
+                printerrno("Couldn't create pipe");
+                exit(EXIT_FAILURE);
+            }
+            if ((pid = fork()) == -1) {
+                printerrno("Creation of child process failed. Exiting");
+                exit(EXIT_FAILURE);
+            }
+            else if (pid == 0) {
+                I_AM_FORK = 1;
+                event_restore_sigmask();
+                if (timeout_ms >= 0)
+                    join_process_group(pgid, own_terminal);
+                REDIRECT_STR(sfds[input? 1 : 0], input? STDOUT_FILENO : STDIN_FILENO);
+                close(sfds[0]);
+                close(sfds[1]);
+                // close all pipe ends of the pipeline, so the other processes will receive EOF
+                if (capfds[0] != -1)
+                    close(capfds[0]);
+                if (capfds[1] != -1)
+                    close(capfds[1]);
+                CLOSE_ALL_PIPES;
+                CLOSE_PROCSUBS;
+                arg[strlen(arg)-1] = '\0';    // strip '<(' and ')'
+                exit_fork(parse_from_file(arg+2));
+            }
+            if (timeout_ms >= 0) {
+                setpgid(pid, pgid);
+                pgid = pgid? pgid : pid;
+            }
+            waitset_add(&children, pid, false);
+            close(sfds[input? 1 : 0]);
+            subfds[nsubs] = sfds[input? 0 : 1];
+            snprintf(subpaths[nsubs], sizeof(subpaths[nsubs]), "/dev/fd/%d", subfds[nsubs]);
+            printdebug("procsub: substituted '%s' with '%s'", arg, subpaths[nsubs]);
+            *args[n] = subpaths[nsubs++];
+        }
+        
+        /**** try to execute cur as a built_in; in a child iff it could block on the pipe ****/
+        bool group = (*cur->cmd != NULL && IS_GROUP(*cur->cmd));
+        bool fork_built_in = (built_in != -1 && stdoutfd != -1 && (built_in_flags(built_in) & BUILT_IN_FORK_IN_PIPE));
+        if (fork_built_in)
+            status = -1;
+        else if ((status = exec_built_in(cur, stdinfd, stdoutfd)) != -1) {
             printdebug("built-in: executed '%s'", *cur->cmd);
             CLOSE_PREV_PIPE
+            CLOSE_PROCSUBS
+            continue;
+        }
+
+        /**** cur is not a built-in; let the zygote launch it, if any (no process groups, /dev/fd or heredocs there) ****/
+        pid = -1;
+        if (USE_ZYGOTE && timeout_ms < 0 && !fork_built_in && !group && nsubs == 0 && cur->heredoc == NULL && (pid = zygote_spawn(cur, stdinfd, stdoutfd)) != -1) {
+            waitset_add(&children, pid, true);
+            last_child = pid;
+            CLOSE_PREV_PIPE
             continue;
         }
 
-        /**** cur is not a built-in; fork a child process ****/
-        nbchildren++;
-        pid_t pid = fork();
+        /**** else fork a child process ****/
+        pid = fork();
         if (pid == -1) {
             printerrno("Creation of child process failed. Exiting");
             exit(EXIT_FAILURE);
@@ -411,36 +1120,100 @@ int execute(comd *pipeline, int npipes) {
             // ######## child process execution: redirect streams, setup pipe and execv ########
             printdebug("fork: now executing '%s'", *cur->cmd);
             I_AM_FORK = 1;
+            event_restore_sigmask();
+            if (timeout_ms >= 0)
+                join_process_group(pgid, own_terminal);
             
             redirectstreams(cur, stdinfd, stdoutfd);
             CLOSE_ALL_PIPES; // no longer needed
+            // note: the capture pipe is close-on-exec, but a forked built_in or group doesn't exec
+            if (capfds[0] != -1)
+                close(capfds[0]);
+            if (capfds[1] != -1)
+                close(capfds[1]);
+            if (fork_built_in)
+                exit_fork(parse_built_in(cur, built_in));
+            if (group) {
+                (*cur->cmd)[strlen(*cur->cmd)-1] = '\0';    // strip '(' and ')'
+                exit_fork(parseexpr(*cur->cmd + 1));
+            }
             // TODO use exevp to auto search for the cmd, using the PATH env
             if (execvp(*cur->cmd, cur->cmd) < 0) {
-                printerrno("couldn't execute command '%s'", *cur->cmd); //TODO here no color since !(is_interactive)...
-                exit(EXIT_FAILURE);
+                print_exec_error(*cur->cmd); //TODO here no color since !(is_interactive)...
+                exit_fork(EXIT_FAILURE);
             }
         }
         // ######## parent process execution: continue loop ########
+        if (timeout_ms >= 0) {
+            setpgid(pid, pgid); // also in the parent, to avoid races with kill() below
+            pgid = pgid? pgid : pid;
+        }
+        waitset_add(&children, pid, false);
+        last_child = pid;
         CLOSE_PREV_PIPE
+        CLOSE_PROCSUBS
     }
     // ######## continued parent process execution: wait for children completion ########
     CLOSE_ALL_PIPES; // close all remaining open pipe fds; no longer needed
+    // the children can't change jsh's cwd: compute the next prompt while they run
+    if (children.nb > 0 && !I_AM_FORK)
+        prompt_preload();
+    if (capfds[0] != -1)
+        capture_pump(capfds[0], last_child);     // until the last cmd terminated and its output is read
+
+    // the children take the terminal themselves as well, so it doesn't matter who comes first
+    own_terminal = own_terminal && pgid;
+    if (own_terminal)
+        give_terminal_to(pgid);
 
-    // wait for children completion
-    WAITING_FOR_CHILD = true;
-    int statuschild = 0;
-    for (k = 0; k < nbchildren; k++) {
-        wait(&statuschild);
-        printdebug("waiting completed: child %d of %d", k+1, nbchildren);
+    // wait for children completion; escalate SIGTERM -> SIGKILL when the deadline expires
+    int statuschild = 0, st;
+    bool timed_out = false;
+    long long deadline = (timeout_ms >= 0 && pgid)? now_ms() + timeout_ms : -1;
+    #define REMAINING(deadline) ((deadline < 0)? -1 : (deadline > now_ms())? deadline - now_ms() : 0)
+    // jsh itself also services the children watched by the event loop (e.g. queued tasks) meanwhile
+    if (!I_AM_FORK)
+        children.wake_fd = event_children_fd();
+    while ((pid = waitset_wait(&children, &st, REMAINING(deadline))) != -1) {
+        if (pid == WAITSET_WOKEN) {
+            event_reap_children();
+            continue;
+        }
+        if (pid == WAITSET_FAILED)
+            continue;   // the remaining children are reaped with a blocking wait
+        if (pid == 0) {
+            printdebug("timeout: sending %s to process group %d", timed_out? "SIGKILL" : "SIGTERM", pgid);
+            kill(-pgid, timed_out? SIGKILL : SIGTERM);
+            kill(-pgid, SIGCONT);   // a stopped process can't handle the SIGTERM
+            deadline = (!timed_out && kill_ms >= 0)? now_ms() + kill_ms : -1;
+            timed_out = true;
+            continue;
+        }
+        printdebug("waiting completed: child %d", pid);
+        if (pid == last_child)
+            statuschild = st;
+    }
+    waitset_free(&children);
+    if (timed_out && kill(-pgid, 0) == 0) {
+        printdebug("timeout: sending SIGKILL to remaining processes in group %d", pgid);
+        kill(-pgid, SIGKILL);
     }
-    WAITING_FOR_CHILD = false;
+    if (own_terminal)
+        give_terminal_to(getpgrp());
+    // e.g. 'sudo -v' or 'sudo -k' may have changed the sudo status shown in the prompt
+    if (ran_sudo)
+        prompt_sudo_changed();
     
     // free() the comd list
     freecomdlist(pipeline);
     
     // return status of last process in the pipeline
-    status = ((status == -1)? statuschild: status);
-    return ((WIFEXITED(status)? WEXITSTATUS(status): WTERMSIG(status))); //TODO WIFSTOPPED
+    if (timed_out)
+        return TIMEOUT_STATUS;
+    // note: a built_in run by jsh itself returns an exit status, not a waitpid() status
+    if (status != -1)
+        return status;
+    return ((WIFEXITED(statuschild)? WEXITSTATUS(statuschild): WTERMSIG(statuschild))); //TODO WIFSTOPPED
     
     /*int rv;
     if ( WIFSIGNALED(status) ) {
@@ -477,21 +1250,47 @@ int exec_built_in(comd *comd, int stdinfd, int stdoutfd) {
     // redirect std streams, parse built_in and restore std streams
     int saved_stdin = dup(STDIN_FILENO);        
     int saved_stdout = dup(STDOUT_FILENO);
+    int saved_stderr = dup(STDERR_FILENO);
     redirectstreams(comd, stdinfd, stdoutfd);
     int rv = parse_built_in(comd, i);
+    fflush(stdout);
     REDIRECT_STR(saved_stdin, STDIN_FILENO);
     REDIRECT_STR(saved_stdout, STDOUT_FILENO);
+    REDIRECT_STR(saved_stderr, STDERR_FILENO);
     close(saved_stdin);
     close(saved_stdout);
+    close(saved_stderr);
     
     return rv;
 }
 
+/*
+ * give_terminal_to: make the provided process group the foreground process group of the
+ *  controlling terminal (ignoring the SIGTTOU jsh receives when not in the foreground itself)
+ */
+void give_terminal_to(pid_t pgid) {
+    void (*prev)(int) = signal(SIGTTOU, SIG_IGN);
+    if (tcsetpgrp(STDIN_FILENO, pgid) < 0)
+        printerrno("couldn't give the terminal to process group %d", pgid);
+    signal(SIGTTOU, prev);
+}
+
+/*
+ * join_process_group: called by a child of a pipeline with a deadline: join its process group (a new
+ *  one iff pgid is 0) and, iff take_terminal, make it the foreground group before touching the tty;
+ *  otherwise a child reading the tty before jsh gave it the terminal would be stopped by SIGTTIN
+ */
+void join_process_group(pid_t pgid, bool take_terminal) {
+    setpgid(0, pgid);
+    if (take_terminal)
+        give_terminal_to(getpgrp());
+}
+
 /*
  * redirectstreams: redirect stdin, stdout, stderr as specified in the specified comd struct and 
  *  stdinfd/stdoutfd arguments: specifying the file descriptors for the pipeline if any; else -1
  *  note: pipe redirection has priority over explicit redirection
- *  on failure, prints error message and exit(EXIT_FAILURE)
+ *  on failure, prints error message and exit_fork(EXIT_FAILURE)
  */
 void redirectstreams(comd *cmd, int stdinfd, int stdoutfd) {
     if (cmd->inf != NULL) {
@@ -499,11 +1298,24 @@ void redirectstreams(comd *cmd, int stdinfd, int stdoutfd) {
         int fd = open(cmd->inf, O_RDONLY);
         if(fd < 0) {
             printerrno("error opening file '%s'", cmd->inf);
-            exit(EXIT_FAILURE);
+            exit_fork(EXIT_FAILURE);
         }
         dup2(fd, STDIN_FILENO);
         close(fd); // no longer needed
     }
+    if (cmd->heredoc != NULL) {
+        printdebug("redirecting stdin to a %s", cmd->herestring? "here-string" : "here-document");
+        char *buf = cmd->herestring? concat(2, cmd->heredoc, "\n") : cmd->heredoc;
+        int fd = buffer_fd(buf, cmd->heredoc_length + cmd->herestring);
+        if (cmd->herestring)
+            free(buf);
+        if (fd < 0) {
+            printerrno("error creating %s", cmd->herestring? "here-string" : "here-document");
+            exit_fork(EXIT_FAILURE);
+        }
+        dup2(fd, STDIN_FILENO);
+        close(fd);
+    }
     if (cmd->outf != NULL) {
         printdebug("redirecting stdout to file '%s'", cmd->outf);    
         int fd;
@@ -513,7 +1325,7 @@ void redirectstreams(comd *cmd, int stdinfd, int stdoutfd) {
             fd = open(cmd->outf, O_WRONLY | O_CREAT | O_TRUNC, 0666);
         if(fd < 0) {
             printerrno("error opening file '%s'", cmd->outf);
-            exit(EXIT_FAILURE);
+            exit_fork(EXIT_FAILURE);
         }
         dup2(fd, STDOUT_FILENO);
         close(fd);
@@ -523,7 +1335,7 @@ void redirectstreams(comd *cmd, int stdinfd, int stdoutfd) {
         int fd = open(cmd->errf, O_WRONLY | O_CREAT | O_TRUNC, 0666);
         if(fd < 0) {
             printerrno("error opening file '%s'", cmd->errf);
-            exit(EXIT_FAILURE);
+            exit_fork(EXIT_FAILURE);
         }
         dup2(fd, STDERR_FILENO);
         close(fd);
@@ -24,6 +24,17 @@
 #include "jsh-common.h"
 #include "alias.h"
 
+#define TIMEOUT_STATUS      124     // exit status of a command that was stopped by the timeout built_in
+#define BATCH_FAILED_STATUS 123     // exit status of the batch built_in iff any of its batches failed
+#define PARALLEL_MAX_FAILED 101     // max exit status (nb of failed jobs) of the parallel built_in
+#define PARALLEL_PLACEHOLDER "{}"   // replaced by the input in the cmd template of the parallel built_in
+#define HEREDOC_PENDING     -1      // return value of parseline() iff here-document lines are still to be read
+
+// built_in flags, see built_in_flags()
+#define BUILT_IN_FORK_IN_PIPE   0x1 // run in a forked child when stdout is a pipe
+#define BUILT_IN_NO_CAPTURE     0x2 // a pipeline with this built_in doesn't overwrite the captured output
+#define BUILT_IN_OWN_PROCSUB    0x4 // the process substitutions in the arguments are left to the built_in
+
 struct comd {
     char **cmd;         // NULL-terminated array of pointers to the command's name and its arguments
     int length;         // the length of the **cmd array: cmd[length] = NULL
@@ -31,6 +42,9 @@ struct comd {
     char *outf;         // name of the file for redirecting stdout or NULL
     char *errf;         // name of the file for redirecting stderr or NULL
     int append_out;     // whether or not stdout should append to the file, if redirected
+    char *heredoc;      // here-document or here-string for stdin or NULL
+    size_t heredoc_length;  // the length of the heredoc, without terminating '\0'
+    bool herestring;    // whether or not the heredoc is a here-string, to be followed by a newline
     struct comd *next;  // pointer to the next comd in the pipeline or NULL if no next
 };
 typedef struct comd comd;
@@ -46,6 +60,79 @@ int parse_from_file(char *line);
  */
 int parseexpr(char*);
 
+/*
+ * parseline: parses an inputline with parseexpr(), after reading the bodies of its here-documents
+ *  (if any) from the next lines, that should be passed verbatim to subsequent parseline() calls.
+ *  A NULL line (EOF) ends the pending here-documents.
+ *  returns HEREDOC_PENDING iff more lines are needed; else the exit status of the executed line
+ */
+int parseline(char*);
+
+/*
+ * heredoc_pending: returns whether or not parseline() is reading here-document bodies
+ */
+bool heredoc_pending(void);
+
+/*
+ * heredoc_discard: discards the line whose here-document bodies are being read, if any
+ */
+void heredoc_discard(void);
+
+/*
+ * timeout_cmd: execute the NULL terminated cmd array in a new process group, that is sent
+ *  SIGTERM after timeout_ms and SIGKILL kill_ms after that (iff kill_ms >= 0)
+ *  returns TIMEOUT_STATUS iff the timeout expired; else the exit status of the command
+ */
+int timeout_cmd(char**, long, long);
+
+/*
+ * execute_cmd: execute the NULL terminated cmd array as a single comd, with execute()
+ *  returns the exit status of the command
+ */
+int execute_cmd(char**);
+
+/*
+ * batch_cmd: execute the NULL terminated cmd array, splitting its arguments over as many
+ *  invocations as needed to stay within the system's argument list limit (ARG_MAX), like
+ *  xargs. Everything before the first ":::" (which is dropped) is repeated in each invocation;
+ *  without one, everything up to and including the first "--" is, so that the arguments
+ *  can't be taken for options; without either, only the command name is. At most max_procs
+ *  invocations run in parallel.
+ *  returns the exit status of the command if a single invocation sufficed; else EXIT_SUCCESS
+ *  iff all invocations succeeded and BATCH_FAILED_STATUS otherwise
+ */
+int batch_cmd(char**, int);
+
+/*
+ * parallel_cmd: execute the NULL terminated cmd template once per input (with each '{}' in its
+ *  arguments replaced by the input, or the input appended iff there's no '{}'), keeping at most
+ *  max_procs jobs running. Iff group, the stdout of each job is collected in a memory_file() and
+ *  written out as a whole when the job completes, so the output of jobs isn't interleaved.
+ *  returns the nb of failed jobs (like GNU parallel), up to PARALLEL_MAX_FAILED
+ */
+int parallel_cmd(char**, char**, int, int, bool);
+
+/*
+ * spawn_line: launch the provided cmd line without waiting for it: a simple command by the
+ *  zygote helper (if any) or fork and exec, any other line by a forked jsh
+ * @arg by_zygote: set to true iff the zygote launched the process
+ * @return: the pid of the launched process or -1 on failure
+ */
+pid_t spawn_line(const char*, bool*);
+
+/*
+ * print_exec_error: print an error message for a failed execvp() of the provided command
+ */
+void print_exec_error(char*);
+
+/*
+ * redirectstreams: redirect stdin, stdout, stderr as specified in the specified comd struct and 
+ *  stdinfd/stdoutfd arguments: specifying the file descriptors for the pipeline if any; else -1
+ *  note: pipe redirection has priority over explicit redirection
+ *  on failure, prints error message and exit(EXIT_FAILURE)
+ */
+void redirectstreams(comd*, int, int);
+
 /* 
  * is_valid_cmd: returns whether or not an occurence of a cmd string is valid in a given 
  *  context string. An cmd is valid iff it occurs as a comd in the grammar.
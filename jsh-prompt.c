@@ -0,0 +1,588 @@
+/* This file is part of jsh.
+ *
+ * jsh: A basic UNIX shell implementation in C
+ * Copyright (C) 2014 Jo Van Bulck <jo.vanbulck@student.kuleuven.be>
+ *
+ * jsh is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * jsh is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with jsh.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * jsh-prompt.c: the prompt is compiled once, when it is set, into a list of segments; rendering
+ *  it for each new inputline is then a single pass appending the segments to a reused strbuf.
+ *  The values of the slow segments (sudo access, git dirty work tree) are computed by a worker
+ *  thread, that is waited for at most PROMPT_BUDGET_MS: a late worker's values are shown by
+ *  redrawing the prompt when it completes, see prompt_update(). The worker is already started
+ *  while a command runs, see prompt_preload().
+ */
+
+#include "jsh-prompt.h"
+#include "jsh-colors.h"
+#include "jsh-git.h"
+#include <pwd.h>
+#include <pthread.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+#define SUDO_CACHE_TTL_MS   30000   // max age of the cached sudo status (sudo's own timeout is minutes)
+
+enum segment_type {
+    SEG_LITERAL,        // text
+    SEG_USER_SUDO,      // '%U': the username, in bold red iff sudo access is active
+    SEG_SUDO_SIGN,      // '%$': '#' iff sudo access is active, '$' otherwise
+    SEG_STATUS,         // '%s': the exit status of the last command
+    SEG_STATUS_COLOR,   // '%S': idem, in bold red iff non-zero
+    SEG_CWD,            // '%d': the current working directory, truncated to MAX_DIR_LENGTH
+    SEG_GIT_BRANCH,     // '%g': ' [branch]' (or the abbreviated commit hash) iff the cwd is in a git repository
+    SEG_GIT_DIRTY       // '%c': '*' in bold red iff the git work tree has unstaged changes (as last computed)
+};
+// the segment names for prompt_profile(), indexed by segment_type
+static const char *segment_names[] = {"text", "%U", "%$", "%s", "%S", "%d", "%g", "%c"};
+
+struct segment {
+    enum segment_type type;
+    char *text;         // the text of a SEG_LITERAL, else NULL
+    size_t length;      // the length of the text
+};
+
+// the values of the slow segments
+struct slow_values {
+    int sudo;           // 1 iff sudo access is active, 0 if not, -1 if unknown
+    int dirty;          // as returned by git_dirty()
+};
+
+int MAX_DIR_LENGTH = 25;
+int PROMPT_BUDGET_MS = 5;
+
+extern char **environ;
+
+// #################### helper function definitions ####################
+void add_segment(enum segment_type, strbuf*);
+const char *color_code(const char*, char, int*);
+char *render(int, struct slow_values);
+void render_segment(strbuf*, struct segment*, int, struct slow_values);
+long long now_ns(void);
+long long sys_time_ns(void);
+void format_ns(char*, size_t, double);
+int compare_ll(const void*, const void*);
+struct slow_values get_slow_values(void);
+int start_scan(void);
+struct slow_values needed_values(void);
+void start_worker(struct slow_values);
+void *compute_slow_values(void*);
+const char *username(void);
+bool has_sudo(void);
+void render_cwd(strbuf*);
+
+static struct segment *segments = NULL;     // the compiled prompt
+static int nb_segments = 0;
+static int max_segments = 0;                // allocated length of the segments array
+static strbuf rendered = STRBUF_INIT;       // the last rendered prompt
+static int last_status = 0;                 // the exit status it was rendered for
+
+static pthread_mutex_t slow_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t slow_done = PTHREAD_COND_INITIALIZER;
+static struct slow_values slow = {-1, -1};  // the values computed by the last worker
+static struct slow_values todo;             // the values the running worker computes (non-zero)
+static bool worker_busy = false;
+static bool late = false;                   // whether or not the displayed prompt waits for the worker
+static int update_pipe[2] = {-1, -1};       // written to when a late worker completed
+static long long sudo_checked = 0;          // now_ms() of the last sudo check; 0 iff slow.sudo is stale
+static int sudo_generation = 0;             // incremented by prompt_sudo_changed()
+static int nb_children = 0;                 // nb of child processes spawned for the prompt
+
+void prompt_compile(const char *prompt) {
+    int i, skip;
+    for (i = 0; i < nb_segments; i++)
+        free(segments[i].text);
+    nb_segments = 0;
+    
+    strbuf literal = STRBUF_INIT;
+    const char *p, *code;
+    for (p = prompt; *p != '\0'; p++) {
+        if (*p != '%') {
+            // copy a run of plain chars at once
+            size_t len = strcspn(p, "%");
+            strbuf_append(&literal, p, len);
+            p += len-1;
+            continue;
+        }
+        switch (*++p) {
+            case 'f':
+            case 'F':
+            case 'b':
+                if ((code = color_code(p+1, *p, &skip)) == NULL) {
+                    printerr("prompt: skipping empty color prompt option: specify a color with '%%%c{color_name}'", *p);
+                    break;
+                }
+                strbuf_appends(&literal, code);
+                p += skip;
+                break;
+            case 'B':
+                strbuf_appends(&literal, COLOR_BOLD);
+                break;
+            case 'n':
+                strbuf_appends(&literal, COLOR_RESET_BOLD);
+                break;
+            case 'u':
+                strbuf_appends(&literal, username());
+                break;
+            case 'h':
+                {
+                char hostname[HOST_NAME_MAX+1] = "";
+                gethostname(hostname, sizeof(hostname));
+                hostname[HOST_NAME_MAX] = '\0';   // always null-terminate
+                strbuf_appends(&literal, hostname);
+                break;
+                }
+            case '%':
+                strbuf_append(&literal, "%", 1);
+                break;
+            case 'U': add_segment(SEG_USER_SUDO, &literal); break;
+            case '$': add_segment(SEG_SUDO_SIGN, &literal); break;
+            case 's': add_segment(SEG_STATUS, &literal); break;
+            case 'S': add_segment(SEG_STATUS_COLOR, &literal); break;
+            case 'd': add_segment(SEG_CWD, &literal); break;
+            case 'g': add_segment(SEG_GIT_BRANCH, &literal); break;
+            case 'c': add_segment(SEG_GIT_DIRTY, &literal); break;
+            case '\0':
+                printerr("prompt: skipping trailing '%%'");
+                p--;
+                break;
+            default:
+                printerr("prompt: skipping unrecognized prompt option '%%%c'", *p);
+                break;
+        }
+    }
+    if (literal.len > 0)
+        add_segment(SEG_LITERAL, &literal);
+    strbuf_free(&literal);
+    printdebug("prompt: compiled into %d segments", nb_segments);
+}
+
+char *prompt_render(int status) {
+    last_status = status;
+    return render(status, get_slow_values());
+}
+
+void prompt_preload(void) {
+    if (!IS_INTERACTIVE)
+        return;
+    start_scan();
+    pthread_mutex_lock(&slow_lock);
+    struct slow_values need = needed_values();
+    if (!worker_busy && (need.sudo || need.dirty))
+        start_worker(need);
+    pthread_mutex_unlock(&slow_lock);
+}
+
+void prompt_sudo_changed(void) {
+    pthread_mutex_lock(&slow_lock);
+    sudo_checked = 0;
+    sudo_generation++;
+    pthread_mutex_unlock(&slow_lock);
+}
+
+int prompt_profile(int n) {
+    long long *times = malloc(sizeof(long long) * n), sys, start;
+    struct slow_values values = slow;
+    strbuf sb = STRBUF_INIT;
+    char mean[16], p99[16], sys_mean[16];
+    int i, k, runs, children;
+    
+    printf("%-8s %10s %10s %10s %9s\n", "segment", "mean", "p99", "sys time", "children");
+    // the total: the prompt as rendered for each inputline, with the slow segments cached
+    for (k = -1; k < nb_segments; k++) {
+        struct segment *seg = (k >= 0)? &segments[k] : NULL;
+        bool sudo_seg = seg && (seg->type == SEG_USER_SUDO || seg->type == SEG_SUDO_SIGN);
+        runs = (sudo_seg && n > PROMPT_PROFILE_SUDO_RUNS)? PROMPT_PROFILE_SUDO_RUNS : n;
+        children = nb_children;
+        sys = sys_time_ns();
+        for (i = 0; i < runs; i++) {
+            start = now_ns();
+            if (seg == NULL)
+                prompt_render(last_status);
+            else {
+                // the slow values as (re)computed by the worker, off the prompt path
+                if (sudo_seg)
+                    values.sudo = has_sudo();
+                else if (seg->type == SEG_GIT_DIRTY) {
+                    git_dirty_invalidate();
+                    git_dirty();
+                    values.dirty = git_dirty_wait();
+                }
+                strbuf_reset(&sb);
+                render_segment(&sb, seg, last_status, values);
+            }
+            times[i] = now_ns() - start;
+        }
+        sys = sys_time_ns() - sys;
+        children = __atomic_load_n(&nb_children, __ATOMIC_RELAXED) - children;
+        
+        double total = 0;
+        for (i = 0; i < runs; i++)
+            total += times[i];
+        qsort(times, runs, sizeof(long long), compare_ll);
+        format_ns(mean, sizeof(mean), total / runs);
+        format_ns(p99, sizeof(p99), times[(runs * 99 + 99) / 100 - 1]);
+        format_ns(sys_mean, sizeof(sys_mean), (double) sys / runs);
+        printf("%-8s %10s %10s %10s %9.2f%s", seg? segment_names[seg->type] : "total", mean, p99, sys_mean,
+            (double) children / runs, (sudo_seg || (seg && seg->type == SEG_GIT_DIRTY))?
+            "   (async, cached: off the prompt path)" : "");
+        if (runs != n)
+            printf(" (over %d uncached sudo check%s)", runs, (runs == 1)? "" : "s");
+        printf("\n");
+    }
+    printf("(per render, over %d renders; the sys time includes the worker threads and children)\n", n);
+    strbuf_free(&sb);
+    free(times);
+    return EXIT_SUCCESS;
+}
+
+int prompt_update_fd(void) {
+    if (update_pipe[0] == -1 && pipe(update_pipe) == 0) {
+        fcntl(update_pipe[0], F_SETFD, FD_CLOEXEC);
+        fcntl(update_pipe[1], F_SETFD, FD_CLOEXEC);
+        fcntl(update_pipe[0], F_SETFL, O_NONBLOCK);
+        fcntl(update_pipe[1], F_SETFL, O_NONBLOCK);
+    }
+    return update_pipe[0];
+}
+
+char *prompt_update(void) {
+    char buf[16];
+    while (read(update_pipe[0], buf, sizeof(buf)) > 0)
+        ;
+    pthread_mutex_lock(&slow_lock);
+    struct slow_values values = slow;
+    pthread_mutex_unlock(&slow_lock);
+    return render(last_status, values);
+}
+
+// #################### helper functions ####################
+
+/*
+ * render: render the compiled prompt for the provided exit status and slow segment values
+ */
+char *render(int status, struct slow_values values) {
+    int i;
+    strbuf_reset(&rendered);
+    strbuf_append(&rendered, "", 0);
+    for (i = 0; i < nb_segments; i++)
+        render_segment(&rendered, &segments[i], status, values);
+    return rendered.buf;
+}
+
+/*
+ * render_segment: append the provided segment for the provided exit status and slow segment values
+ */
+void render_segment(strbuf *sb, struct segment *seg, int status, struct slow_values values) {
+    const char *branch;
+    switch (seg->type) {
+        case SEG_LITERAL:
+            strbuf_append(sb, seg->text, seg->length);
+            break;
+        case SEG_USER_SUDO:
+            strbuf_appendf(sb, (values.sudo == 1)? COLOR_BOLD RED_FG "%s" COLOR_RESET_BOLD RESET_FG : "%s", username());
+            break;
+        case SEG_SUDO_SIGN:
+            strbuf_append(sb, (values.sudo == 1)? "#" : "$", 1);
+            break;
+        case SEG_STATUS:
+            strbuf_appendf(sb, "%d", status);
+            break;
+        case SEG_STATUS_COLOR:
+            strbuf_appendf(sb, status? COLOR_BOLD RED_FG "%d" COLOR_RESET_BOLD RESET_FG : "%d", status);
+            break;
+        case SEG_CWD:
+            render_cwd(sb);
+            break;
+        case SEG_GIT_BRANCH:
+            if ((branch = git_branch()) != NULL)
+                strbuf_appendf(sb, " [%s]", branch);
+            break;
+        case SEG_GIT_DIRTY:
+            if (values.dirty == 1)
+                strbuf_appends(sb, COLOR_BOLD RED_FG "*" COLOR_RESET_BOLD RESET_FG);
+            break;
+    }
+}
+
+/*
+ * get_slow_values: start a worker thread that computes the slow segment values of the compiled
+ *  prompt, and wait for it at most PROMPT_BUDGET_MS (including a preloaded worker that is still
+ *  running, see prompt_preload()). If it is late, the last computed values are returned instead,
+ *  and the worker writes to the update pipe when it completes.
+ */
+struct slow_values get_slow_values(void) {
+    struct slow_values need, values;
+    struct timespec deadline;
+    int dirty = start_scan();
+    
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += PROMPT_BUDGET_MS / 1000;
+    deadline.tv_nsec += (PROMPT_BUDGET_MS % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+    pthread_mutex_lock(&slow_lock);
+    while (worker_busy && pthread_cond_timedwait(&slow_done, &slow_lock, &deadline) == 0)
+        ;
+    need = needed_values();
+    if (!worker_busy && (need.sudo || need.dirty)) {
+        start_worker(need);
+        while (worker_busy && pthread_cond_timedwait(&slow_done, &slow_lock, &deadline) == 0)
+            ;
+    }
+    late = worker_busy;
+    values = slow;
+    // the last computed value of the current repository, rather than of the previous prompt's one
+    if (late)
+        values.dirty = dirty;
+    pthread_mutex_unlock(&slow_lock);
+    printdebug("prompt: slow segments %s", late? "late, the prompt will be redrawn" : "computed in time");
+    return values;
+}
+
+/*
+ * start_scan: let git_dirty() (which isn't thread safe) start the scan the worker waits for,
+ *  iff the compiled prompt has a '%c' segment
+ * @return: the value returned by git_dirty(), or -1
+ */
+int start_scan(void) {
+    int i;
+    for (i = 0; i < nb_segments; i++)
+        if (segments[i].type == SEG_GIT_DIRTY)
+            return git_dirty();
+    return -1;
+}
+
+/*
+ * needed_values: returns which slow values (non-zero) the compiled prompt needs (re)computed;
+ *  should be called with slow_lock held
+ */
+struct slow_values needed_values(void) {
+    struct slow_values need = {0, 0};
+    int i;
+    for (i = 0; i < nb_segments; i++) {
+        need.sudo |= (segments[i].type == SEG_USER_SUDO || segments[i].type == SEG_SUDO_SIGN);
+        need.dirty |= (segments[i].type == SEG_GIT_DIRTY);
+    }
+    // a single sudo check serves all prompts until it expires or a 'sudo' cmd was executed
+    if (need.sudo && sudo_checked != 0 && now_ms() - sudo_checked < SUDO_CACHE_TTL_MS)
+        need.sudo = 0;
+    return need;
+}
+
+/*
+ * start_worker: start a compute_slow_values() thread for the provided values; should be called
+ *  with slow_lock held, iff !worker_busy
+ */
+void start_worker(struct slow_values need) {
+    pthread_t thread;
+    pthread_attr_t attr;
+    todo = need;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    worker_busy = (pthread_create(&thread, &attr, compute_slow_values, NULL) == 0);
+    pthread_attr_destroy(&attr);
+}
+
+/*
+ * compute_slow_values: worker thread main function that computes the slow segment values
+ *  requested in todo
+ */
+void *compute_slow_values(void *arg) {
+    struct slow_values need = todo, values = {-1, -1};
+    pthread_mutex_lock(&slow_lock);
+    int generation = sudo_generation;
+    pthread_mutex_unlock(&slow_lock);
+    long long checked = now_ms();
+    if (need.sudo)
+        values.sudo = has_sudo();
+    if (need.dirty)
+        values.dirty = git_dirty_wait();
+    
+    pthread_mutex_lock(&slow_lock);
+    slow.sudo = need.sudo? values.sudo : slow.sudo;
+    // unless a 'sudo' cmd was executed during the check
+    if (need.sudo && generation == sudo_generation)
+        sudo_checked = checked;
+    slow.dirty = need.dirty? values.dirty : -1;
+    worker_busy = false;
+    if (late && update_pipe[1] != -1 && write(update_pipe[1], "", 1) == 1)
+        late = false;
+    pthread_cond_broadcast(&slow_done);
+    pthread_mutex_unlock(&slow_lock);
+    return NULL;
+}
+
+/*
+ * add_segment: add a segment of the provided type to the compiled prompt, preceded by a
+ *  SEG_LITERAL segment with the pending literal text, if any (emptying the literal strbuf)
+ */
+void add_segment(enum segment_type type, strbuf *literal) {
+    if (type != SEG_LITERAL && literal->len > 0)
+        add_segment(SEG_LITERAL, literal);
+    if (nb_segments == max_segments) {
+        max_segments = max_segments? 2*max_segments : 8;
+        segments = realloc(segments, sizeof(struct segment) * max_segments);
+    }
+    struct segment *seg = &segments[nb_segments++];
+    seg->type = type;
+    seg->text = (type == SEG_LITERAL)? strclone(literal->buf) : NULL;
+    seg->length = (type == SEG_LITERAL)? literal->len : 0;
+    if (type == SEG_LITERAL)
+        strbuf_reset(literal);
+}
+
+/*
+ * color_code: returns the ANSI escape code for the '{color_name}' at the start of the provided
+ *  string, for the provided prompt option ('f': fg color, 'F': bold fg color, 'b': bg color);
+ *  or NULL if there is no valid color name
+ * @arg skip: set to the length of the '{color_name}'
+ */
+const char *color_code(const char *str, char option, int *skip) {
+    static const char *names[] = {"black", "red", "green", "yellow", "blue", "magenta", "cyan", "white", "reset", "resetall"};
+    static const char *fg[] = {BLACK_FG, RED_FG, GREEN_FG, YELLOW_FG, BLUE_FG, MAGENTA_FG, CYAN_FG, WHITE_FG, RESET_FG, COLOR_RESET_ALL};
+    static const char *bold_fg[] = {COLOR_BOLD BLACK_FG, COLOR_BOLD RED_FG, COLOR_BOLD GREEN_FG, COLOR_BOLD YELLOW_FG,
+        COLOR_BOLD BLUE_FG, COLOR_BOLD MAGENTA_FG, COLOR_BOLD CYAN_FG, COLOR_BOLD WHITE_FG, COLOR_RESET_BOLD RESET_FG, COLOR_RESET_ALL};
+    static const char *bg[] = {BLACK_BG, RED_BG, GREEN_BG, YELLOW_BG, BLUE_BG, MAGENTA_BG, CYAN_BG, WHITE_BG, RESET_BG, COLOR_RESET_ALL};
+    int i;
+    const char *end = strchr(str, '}');
+    if (*str != '{' || end == NULL)
+        return NULL;
+    for (i = 0; i < sizeof(names)/sizeof(names[0]); i++)
+        if (strlen(names[i]) == end - str - 1 && strncmp(str+1, names[i], end - str - 1) == 0) {
+            *skip = end - str + 1;
+            return (option == 'f')? fg[i] : (option == 'F')? bold_fg[i] : bg[i];
+        }
+    return NULL;
+}
+
+/*
+ * username: returns the name of the current user: $USER, or from the password database iff unset
+ */
+const char *username(void) {
+    static const char *name = NULL;
+    if (name == NULL) {
+        struct passwd *pw;
+        name = getenv("USER");
+        if (name == NULL)
+            name = ((pw = getpwuid(getuid())) != NULL)? strclone(pw->pw_name) : "?";
+    }
+    return name;
+}
+
+/*
+ * has_sudo: returns whether or not sudo access is active, i.e. sudo doesn't ask for a password
+ *  see e.g. http://stackoverflow.com/questions/122276/quickly-check-whether-sudo-permissions-are-available
+ *  Called from the worker thread, so spawned directly rather than through the parser.
+ */
+bool has_sudo(void) {
+    char *argv[] = {"sudo", "-n", "true", NULL};
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attr;
+    sigset_t mask, defaults;
+    pid_t pid;
+    int status = -1, rv;
+    
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+    posix_spawn_file_actions_addopen(&actions, STDERR_FILENO, "/dev/null", O_WRONLY, 0);
+    // the signals routed to the event loop are blocked (see event_restore_sigmask())
+    sigemptyset(&mask);
+    sigemptyset(&defaults);
+    sigaddset(&defaults, SIGINT);
+    sigaddset(&defaults, SIGCHLD);
+    sigaddset(&defaults, SIGWINCH);
+    posix_spawnattr_init(&attr);
+    posix_spawnattr_setsigmask(&attr, &mask);
+    posix_spawnattr_setsigdefault(&attr, &defaults);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
+    if ((rv = posix_spawnp(&pid, "sudo", &actions, &attr, argv, environ)) == 0)
+        __atomic_add_fetch(&nb_children, 1, __ATOMIC_RELAXED);
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+    
+    while (rv == 0 && waitpid(pid, &status, 0) == -1 && errno == EINTR)
+        ;
+    return rv == 0 && WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS;
+}
+
+/*
+ * render_cwd: append the current working directory, with the home directory replaced by '~',
+ *  and 'smart' truncated to MAX_DIR_LENGTH: from the first '/' within the last MAX_DIR_LENGTH chars
+ */
+void render_cwd(strbuf *sb) {
+    char *cwd = getcwd(NULL, 0);
+    if (cwd == NULL) {
+        strbuf_append(sb, "?", 1);
+        return;
+    }
+    char *dir = cwd, *home = gethome(), *ptr = NULL;
+    size_t homelen = strlen(home);
+    if (homelen > 1 && strncmp(cwd, home, homelen) == 0 && (cwd[homelen] == '/' || cwd[homelen] == '\0')) {
+        dir = cwd + homelen - 1;
+        *dir = '~';
+    }
+    int dirlen = strlen(dir);
+    if (dirlen > MAX_DIR_LENGTH) {
+        ptr = strchr(dir + dirlen - MAX_DIR_LENGTH, '/');
+        ptr = (ptr && ptr < dir+dirlen-1)? ptr+1 : ptr;
+    }
+    strbuf_appends(sb, ptr? ptr : dir + ((MAX_DIR_LENGTH < dirlen)? dirlen - MAX_DIR_LENGTH : 0));
+    free(cwd);
+}
+
+/*
+ * now_ns: returns the monotonic time in ns
+ */
+long long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/*
+ * sys_time_ns: returns the system CPU time of jsh (all threads) and its reaped children, in ns
+ */
+long long sys_time_ns(void) {
+    struct rusage self, children;
+    getrusage(RUSAGE_SELF, &self);
+    getrusage(RUSAGE_CHILDREN, &children);
+    return (self.ru_stime.tv_sec + children.ru_stime.tv_sec) * 1000000000LL +
+        (self.ru_stime.tv_usec + children.ru_stime.tv_usec) * 1000LL;
+}
+
+/*
+ * format_ns: format the provided duration in ns with a unit, e.g. '850ns', '12.3us', '4.20ms'
+ */
+void format_ns(char *buf, size_t size, double ns) {
+    if (ns < 1000)
+        snprintf(buf, size, "%.0fns", ns);
+    else if (ns < 1000000)
+        snprintf(buf, size, "%.1fus", ns / 1000);
+    else
+        snprintf(buf, size, "%.2fms", ns / 1000000);
+}
+
+/*
+ * compare_ll: qsort() comparison function for long longs
+ */
+int compare_ll(const void *a, const void *b) {
+    long long x = *(const long long*) a, y = *(const long long*) b;
+    return (x > y) - (x < y);
+}
@@ -0,0 +1,85 @@
+/* This file is part of jsh.
+ *
+ * jsh: A basic UNIX shell implementation in C
+ * Copyright (C) 2014 Jo Van Bulck <jo.vanbulck@student.kuleuven.be>
+ *
+ * jsh is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * jsh is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with jsh.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PROMPT_H_INCLUDED
+#define PROMPT_H_INCLUDED
+/* ^^ these are the include guards */
+
+#include "jsh-common.h"
+
+extern int MAX_DIR_LENGTH;  // the maximum length of an expanded pwd substring in the prompt string
+#define PROMPT_PROFILE_RUNS 100     // default nb of renders for 'prompt --profile'
+#define PROMPT_PROFILE_SUDO_RUNS 1  // nb of uncached sudo checks per sudo segment for 'prompt --profile'
+
+extern int PROMPT_BUDGET_MS;// the maximum time to wait for the slow prompt segments ('%U', '%$', '%c')
+
+/*
+ * prompt_compile: compile the provided prompt string into the list of segments that
+ *  prompt_render() renders: literal text (with the '%f{color}', '%F{color}', '%b{color}', '%B'
+ *  and '%n' color codes, and the '%u' username and '%h' hostname resolved once, here) and the
+ *  dynamic '%U', '%$', '%s', '%S', '%d', '%g' and '%c' expansions. Unrecognized options are
+ *  reported and skipped.
+ */
+void prompt_compile(const char*);
+
+/*
+ * prompt_render: render the compiled prompt for the provided exit status of the last command.
+ *  Slow segments not computed within PROMPT_BUDGET_MS show their last computed values; the
+ *  prompt_update_fd() is then readable when they complete.
+ *  The returned string is valid until the next prompt_render() or prompt_update() call.
+ */
+char *prompt_render(int);
+
+/*
+ * prompt_profile: render the compiled prompt n times and print the mean and 99th percentile
+ *  render time, system CPU time and nb of spawned child processes of each segment, and of the
+ *  whole prompt. The slow segments are timed as computed by the worker thread, uncached; the
+ *  sudo segments only PROMPT_PROFILE_SUDO_RUNS times, as each check spawns a (logged) sudo.
+ * @return: EXIT_SUCCESS
+ */
+int prompt_profile(int);
+
+/*
+ * prompt_preload: start computing the slow segment values of the next prompt, concurrently
+ *  with a running command, iff IS_INTERACTIVE. The next prompt_render() reuses them unless
+ *  the state they depend on changed: the git scan is redone iff inotify reported a change
+ *  of the index or work tree, and the sudo status iff the command ran 'sudo'.
+ */
+void prompt_preload(void);
+
+/*
+ * prompt_sudo_changed: invalidate the cached sudo status of the '%U' and '%$' segments, that
+ *  is otherwise checked again after SUDO_CACHE_TTL_MS. Should be called when a 'sudo' cmd
+ *  is executed, as it may have changed (e.g. 'sudo -v', 'sudo -k').
+ */
+void prompt_sudo_changed(void);
+
+/*
+ * prompt_update_fd: returns the file descriptor that is readable when the slow segments of
+ *  the displayed prompt completed after prompt_render() returned
+ */
+int prompt_update_fd(void);
+
+/*
+ * prompt_update: render the last rendered prompt again, with the values of the completed
+ *  slow segments. Should be called when prompt_update_fd() is readable.
+ */
+char *prompt_update(void);
+
+#endif //PROMPT_H_INCLUDED
@@ -0,0 +1,255 @@
+/* This file is part of jsh.
+ *
+ * jsh: A basic UNIX shell implementation in C
+ * Copyright (C) 2014 Jo Van Bulck <jo.vanbulck@student.kuleuven.be>
+ *
+ * jsh is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * jsh is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with jsh.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * jsh-queue.c: a task queue, in the style of task-spooler. Queued cmd lines run in the
+ *  background, at most queue_limit at a time, while the prompt stays available: the event
+ *  loop reaps a completed task and launches the next one, so a burst of submitted tasks
+ *  doesn't oversubscribe the machine. The output of each task is logged in a memory_file().
+ */
+
+#include "jsh-queue.h"
+#include "jsh-parse.h"
+#include "jsh-event.h"
+#include <stdint.h>
+
+enum task_state {QUEUED, RUNNING, DONE};
+
+struct task {
+    int id;                 // unique id, as shown to the user
+    int priority;           // tasks with a higher priority are launched first
+    char *line;             // the cmd line
+    enum task_state state;
+    pid_t pid;              // the pid of the forked jsh that runs the task, iff not QUEUED
+    int status;             // the waitpid() status of the task, iff DONE
+    int logfd;              // memory_file() with the stdout and stderr of the task, or -1
+    long long start_ms;     // start time, iff not QUEUED
+    long long end_ms;       // end time, iff DONE
+};
+
+// #################### helper function definitions ####################
+void launch_tasks(void);
+void start_task(struct task*);
+void task_done(pid_t, int, void*);
+struct task *find_task(int);
+
+static struct task *tasks = NULL;   // all tasks, ordered by id
+static int nb_tasks = 0;
+static int max_tasks = 0;           // allocated length of the tasks array
+static int next_id = 1;
+static int nb_running = 0;
+static int limit = 0;               // max nb of running tasks; 0 until initialized
+
+int queue_add(const char *line, int priority) {
+    if (nb_tasks == max_tasks) {
+        struct task *new = realloc(tasks, sizeof(struct task) * (max_tasks? max_tasks*2 : 16));
+        if (new == NULL) {
+            printerrno("queue: couldn't allocate memory for a new task");
+            return -1;
+        }
+        tasks = new;
+        max_tasks = max_tasks? max_tasks*2 : 16;
+    }
+    struct task *t = &tasks[nb_tasks++];
+    memset(t, 0, sizeof(struct task));
+    t->id = next_id++;
+    t->priority = priority;
+    t->line = strclone(line);
+    t->state = QUEUED;
+    t->logfd = -1;
+    int id = t->id;
+    launch_tasks();
+    return id;
+}
+
+void queue_list(void) {
+    int i;
+    long long now = now_ms();
+    printf("%4s  %-10s %5s %9s  %s\n", "id", "state", "prio", "time", "cmd");
+    for (i = 0; i < nb_tasks; i++) {
+        struct task *t = &tasks[i];
+        char state[32], time[32] = "-";
+        if (t->state == QUEUED)
+            snprintf(state, sizeof(state), "queued");
+        else if (t->state == RUNNING)
+            snprintf(state, sizeof(state), "running");
+        else if (WIFEXITED(t->status))
+            snprintf(state, sizeof(state), WEXITSTATUS(t->status)? "failed %d" : "done", WEXITSTATUS(t->status));
+        else
+            snprintf(state, sizeof(state), "killed %d", WTERMSIG(t->status));
+        if (t->state != QUEUED)
+            snprintf(time, sizeof(time), "%.1fs", (((t->state == DONE)? t->end_ms : now) - t->start_ms) / 1000.0);
+        printf("%4d  %-10s %5d %9s  %s\n", t->id, state, t->priority, time, t->line);
+    }
+}
+
+int queue_wait(int id) {
+    struct task *t;
+    int i;
+    if (id != -1 && find_task(id) == NULL) {
+        printerr("queue: no such task: %d", id);
+        return EXIT_FAILURE;
+    }
+    // the watched tasks are reaped from the event loop, that isn't running now: reap them here
+    for (;;) {
+        event_reap_children();
+        if (id != -1 && (t = find_task(id))->state == DONE)
+            return WIFEXITED(t->status)? WEXITSTATUS(t->status) : 128 + WTERMSIG(t->status);
+        if (id == -1 && nb_running == 0) {
+            // note: a queued task can only remain iff launching it failed
+            for (i = 0; i < nb_tasks; i++)
+                if (tasks[i].state == DONE && (!WIFEXITED(tasks[i].status) || WEXITSTATUS(tasks[i].status)))
+                    return EXIT_FAILURE;
+            return EXIT_SUCCESS;
+        }
+        if (!event_wait_children()) {
+            printerr("queue: interrupted; the tasks keep running in the background");
+            return EXIT_FAILURE;
+        }
+    }
+}
+
+int queue_log(int id, int fd) {
+    struct task *t = find_task(id);
+    if (t == NULL) {
+        printerr("queue: no such task: %d", id);
+        return EXIT_FAILURE;
+    }
+    if (t->logfd == -1)
+        return EXIT_SUCCESS;
+    // note: pread(), so the file offset shared with a running task isn't changed
+    char buf[BUFSIZ];
+    off_t off = 0;
+    ssize_t n;
+    while ((n = pread(t->logfd, buf, sizeof(buf), off)) > 0) {
+        if (write_full(fd, buf, n) != EXIT_SUCCESS)
+            return EXIT_FAILURE;
+        off += n;
+    }
+    return (n == 0)? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+void queue_set_limit(int max) {
+    limit = (max > 0)? max : 1;
+    launch_tasks();
+}
+
+int queue_get_limit(void) {
+    if (limit == 0)
+        limit = online_cpus();
+    return limit;
+}
+
+void queue_clear(void) {
+    int i, j;
+    for (i = 0, j = 0; i < nb_tasks; i++)
+        if (tasks[i].state == DONE) {
+            free(tasks[i].line);
+            if (tasks[i].logfd != -1)
+                close(tasks[i].logfd);
+        }
+        else
+            tasks[j++] = tasks[i];
+    nb_tasks = j;
+}
+
+/*
+ * launch_tasks: launch the queued tasks with the highest priority (in FIFO order), as long as
+ *  fewer than limit tasks are running
+ */
+void launch_tasks(void) {
+    int i;
+    while (nb_running < queue_get_limit()) {
+        struct task *next = NULL;
+        for (i = 0; i < nb_tasks; i++)
+            if (tasks[i].state == QUEUED && (next == NULL || tasks[i].priority > next->priority))
+                next = &tasks[i];
+        if (next == NULL)
+            return;
+        start_task(next);
+    }
+}
+
+/*
+ * start_task: fork a jsh that runs the cmd line of the provided task in its own process group
+ *  (so a ^C at the prompt doesn't reach it), with stdin from /dev/null and logged output
+ */
+void start_task(struct task *t) {
+    if ((t->logfd = memory_file()) == -1)
+        printerrno("queue: couldn't create a log for task %d; discarding its output", t->id);
+    t->start_ms = now_ms();
+    pid_t pid = fork();
+    if (pid == 0) {
+        I_AM_FORK = true;
+        setpgid(0, 0);
+        event_restore_sigmask();
+        int in = open("/dev/null", O_RDWR);
+        int out = (t->logfd != -1)? t->logfd : in;
+        REDIRECT_STR(in, STDIN_FILENO);
+        REDIRECT_STR(out, STDOUT_FILENO);
+        REDIRECT_STR(out, STDERR_FILENO);
+        exit_fork(parse_from_file(strclone(t->line)));
+    }
+    if (pid != -1)
+        setpgid(pid, pid);  // avoid a race with the child's setpgid()
+    if (pid != -1 && event_watch_pid(pid, task_done, (void*) (intptr_t) t->id) != EXIT_SUCCESS) {
+        // the event loop can't reap the task: don't leave it running unwatched
+        int err = errno;
+        kill(-pid, SIGKILL);
+        waitpid(pid, NULL, 0);
+        errno = err;
+        pid = -1;
+    }
+    if (pid == -1) {
+        printerrno("queue: couldn't launch task %d", t->id);
+        t->state = DONE;
+        t->status = EXIT_FAILURE << 8;  // i.e. WEXITSTATUS(status) == EXIT_FAILURE
+        t->end_ms = t->start_ms;
+        return;
+    }
+    printdebug("queue: launched task %d with pid %d", t->id, pid);
+    t->pid = pid;
+    t->state = RUNNING;
+    nb_running++;
+}
+
+/*
+ * task_done: event loop callback for a terminated task: launch the next ones
+ */
+void task_done(pid_t pid, int status, void *arg) {
+    struct task *t = find_task((intptr_t) arg);
+    nb_running--;
+    if (t != NULL) {
+        t->state = DONE;
+        t->status = status;
+        t->end_ms = now_ms();
+    }
+    launch_tasks();
+}
+
+/*
+ * find_task: returns the task with the provided id, or NULL if there is none
+ */
+struct task *find_task(int id) {
+    int i;
+    for (i = 0; i < nb_tasks; i++)
+        if (tasks[i].id == id)
+            return &tasks[i];
+    return NULL;
+}
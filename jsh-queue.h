@@ -0,0 +1,70 @@
+/* This file is part of jsh.
+ *
+ * jsh: A basic UNIX shell implementation in C
+ * Copyright (C) 2014 Jo Van Bulck <jo.vanbulck@student.kuleuven.be>
+ *
+ * jsh is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * jsh is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with jsh.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef QUEUE_H_INCLUDED
+#define QUEUE_H_INCLUDED
+/* ^^ these are the include guards */
+
+#include "jsh-common.h"
+
+/*
+ * queue_add: add the provided cmd line to the task queue; it runs in the background (in a
+ *  forked jsh, with stdin from /dev/null and stdout and stderr logged) as soon as fewer than
+ *  the queue limit tasks are running. Tasks with a higher priority run first; equal
+ *  priorities in FIFO order.
+ * @return: the id of the new task, or -1 on failure
+ */
+int queue_add(const char*, int);
+
+/*
+ * queue_list: print the id, state, priority and cmd line of all tasks in the queue
+ */
+void queue_list(void);
+
+/*
+ * queue_wait: wait for the task with the provided id to complete, or for all tasks iff -1;
+ *  stops waiting on ^C
+ * @return: the exit status of the task (128 + the signal nb iff it was killed; EXIT_SUCCESS
+ *  iff all tasks succeeded, for -1), or EXIT_FAILURE if there is no such task or the wait
+ *  was interrupted
+ */
+int queue_wait(int);
+
+/*
+ * queue_log: write the logged output of the task with the provided id to fd
+ * @return: EXIT_SUCCESS or EXIT_FAILURE
+ */
+int queue_log(int, int);
+
+/*
+ * queue_set_limit: set the max nb of concurrently running tasks (at least 1),
+ *  launching queued tasks if the limit increased
+ */
+void queue_set_limit(int);
+
+/*
+ * queue_get_limit: returns the max nb of concurrently running tasks
+ */
+int queue_get_limit(void);
+
+/*
+ * queue_clear: remove the completed tasks from the queue, freeing their logs
+ */
+void queue_clear(void);
+
+#endif //QUEUE_H_INCLUDED
@@ -0,0 +1,204 @@
+/* This file is part of jsh.
+ *
+ * jsh: A basic UNIX shell implementation in C
+ * Copyright (C) 2014 Jo Van Bulck <jo.vanbulck@student.kuleuven.be>
+ *
+ * jsh is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * jsh is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with jsh.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * jsh-script.c: batch mode, i.e. 'jsh [-j jobs] script ...'. The ~/.jshrc is parsed once by
+ *  the parent jsh; each script runs in a forked child, so it starts with the parent's aliases
+ *  and settings without reparsing them.
+ */
+
+#include "jsh-script.h"
+#include "jsh-parse.h"
+#include "jsh-wait.h"
+#include "jsh-event.h"
+
+struct script {
+    char *path;
+    pid_t pid;              // iff launched
+    int outfd;              // memory_file() with the stdout and stderr of the script, or -1
+    int status;             // the waitpid() status of the script, iff done
+    long long start_ms;     // start time, iff launched
+    long long end_ms;       // end time, iff done
+    bool done;
+};
+
+// #################### helper function definitions ####################
+pid_t start_script(struct script*);
+void run_script_line(char*);
+void write_prefixed(int, const char*);
+void report_scripts(struct script*, int, int, long long);
+
+static int script_status = EXIT_SUCCESS;   // exit status of the last line of the script, in the child
+
+int run_scripts(char **paths, int n, int jobs) {
+    struct script *scripts = calloc(n, sizeof(struct script));
+    int i, next = 0, st;
+    bool capture = (n > 1), stop = false;
+    long long start_ms = now_ms();
+    waitset children;
+    waitset_init(&children);
+    // jsh itself also services the children watched by the event loop (e.g. queued tasks) meanwhile
+    if (!I_AM_FORK)
+        children.wake_fd = event_children_fd();
+    for (i = 0; i < n; i++)
+        scripts[i].path = paths[i];
+    fflush(stdout);
+    while (children.nb > 0 || (next < n && !stop)) {
+        // launch the next scripts, as long as fewer than jobs are running; stop on ^C
+        while (!stop && next < n && children.nb < jobs) {
+            if (event_interrupted()) {
+                stop = true;
+                break;
+            }
+            struct script *s = &scripts[next++];
+            s->outfd = capture? memory_file() : -1;
+            if (capture && s->outfd == -1)
+                printerrno("couldn't create an output file for script '%s'; not capturing its output", s->path);
+            s->start_ms = now_ms();
+            if ((s->pid = start_script(s)) == -1) {
+                s->done = true;
+                s->status = EXIT_FAILURE << 8;  // i.e. WEXITSTATUS(status) == EXIT_FAILURE
+                s->end_ms = s->start_ms;
+                continue;
+            }
+            waitset_add(&children, s->pid, false);
+        }
+        // reap a completed script and write out its output, if captured
+        pid_t pid = waitset_wait(&children, &st, -1);
+        if (pid == WAITSET_WOKEN)
+            event_reap_children();
+        stop = stop || pid == WAITSET_FAILED;
+        if (pid <= 0)
+            continue;
+        for (i = 0; i < next && (scripts[i].done || scripts[i].pid != pid); i++);
+        if (i == next)
+            continue;
+        scripts[i].done = true;
+        scripts[i].status = st;
+        scripts[i].end_ms = now_ms();
+        if (scripts[i].outfd != -1) {
+            write_prefixed(scripts[i].outfd, scripts[i].path);
+            close(scripts[i].outfd);
+        }
+    }
+    waitset_free(&children);
+    
+    int rv = EXIT_SUCCESS;
+    for (i = 0; i < n; i++)
+        if (!scripts[i].done || !WIFEXITED(scripts[i].status) || WEXITSTATUS(scripts[i].status) != EXIT_SUCCESS)
+            rv = (n == 1 && scripts[i].done && WIFEXITED(scripts[i].status))? WEXITSTATUS(scripts[i].status) : EXIT_FAILURE;
+    if (n > 1)
+        report_scripts(scripts, n, jobs, now_ms() - start_ms);
+    free(scripts);
+    return rv;
+}
+
+/*
+ * start_script: fork a jsh that runs the provided script line per line, like the source built_in
+ * @return: the pid of the child, or -1 on failure
+ */
+pid_t start_script(struct script *s) {
+    pid_t pid = fork();
+    if (pid == 0) {
+        I_AM_FORK = true;
+        event_restore_sigmask();
+        int in = open("/dev/null", O_RDONLY);
+        REDIRECT_STR(in, STDIN_FILENO);
+        if (s->outfd != -1) {
+            REDIRECT_STR(s->outfd, STDOUT_FILENO);
+            REDIRECT_STR(s->outfd, STDERR_FILENO);
+        }
+        if (access(s->path, R_OK) != 0) {
+            printerrno("couldn't read script '%s'", s->path);
+            exit_fork(EXIT_FAILURE);
+        }
+        parsefile(s->path, run_script_line, true);
+        if (heredoc_pending())
+            parseline(NULL);
+        exit_fork(script_status);
+    }
+    if (pid == -1)
+        printerrno("couldn't launch script '%s'", s->path);
+    else
+        printdebug("launched script '%s' with pid %d", s->path, pid);
+    return pid;
+}
+
+/*
+ * run_script_line: parse the provided line of a script, keeping track of the exit status of
+ *  the last executed line (ignoring blank lines and line separators)
+ */
+void run_script_line(char *line) {
+    int rv = parse_from_file(line);
+    if (line[strspn(line, " \t\n")] != '\0' && rv != HEREDOC_PENDING)
+        script_status = rv;
+}
+
+/*
+ * write_prefixed: write the content of the provided file to stdout, with each line
+ *  prefixed by the provided string and ': '
+ */
+void write_prefixed(int fd, const char *prefix) {
+    char *buf, *line, *next;
+    if (lseek(fd, 0, SEEK_SET) == -1 || (buf = read_fd(fd, NULL)) == NULL) {
+        printerrno("couldn't write the output of script '%s'", prefix);
+        return;
+    }
+    for (line = buf; *line != '\0'; line = next) {
+        if ((next = strchr(line, '\n')) != NULL)
+            next++;
+        else
+            next = line + strlen(line);
+        if (write_full(STDOUT_FILENO, prefix, strlen(prefix)) != EXIT_SUCCESS ||
+            write_full(STDOUT_FILENO, ": ", 2) != EXIT_SUCCESS ||
+            write_full(STDOUT_FILENO, line, next - line) != EXIT_SUCCESS ||
+            (next[-1] != '\n' && write_full(STDOUT_FILENO, "\n", 1) != EXIT_SUCCESS))
+            break;
+    }
+    free(buf);
+}
+
+/*
+ * report_scripts: print the status and duration of each of the n scripts, and the totals,
+ *  on stderr
+ */
+void report_scripts(struct script *scripts, int n, int jobs, long long elapsed_ms) {
+    int i, nfailed = 0, nrun = 0;
+    long long work_ms = 0;
+    fprintf(stderr, "%-10s %9s  %s\n", "status", "time", "script");
+    for (i = 0; i < n; i++) {
+        struct script *s = &scripts[i];
+        char state[32], time[32] = "-";
+        if (!s->done)
+            snprintf(state, sizeof(state), "not run");
+        else if (WIFEXITED(s->status))
+            snprintf(state, sizeof(state), WEXITSTATUS(s->status)? "failed %d" : "done", WEXITSTATUS(s->status));
+        else
+            snprintf(state, sizeof(state), "killed %d", WTERMSIG(s->status));
+        if (s->done) {
+            snprintf(time, sizeof(time), "%.2fs", (s->end_ms - s->start_ms) / 1000.0);
+            work_ms += s->end_ms - s->start_ms;
+            nrun++;
+            nfailed += !WIFEXITED(s->status) || WEXITSTATUS(s->status) != EXIT_SUCCESS;
+        }
+        fprintf(stderr, "%-10s %9s  %s\n", state, time, s->path);
+    }
+    fprintf(stderr, "%d scripts in %.2fs (%.2fs of work on %d job%s): %d succeeded, %d failed, %d not run\n",
+        n, elapsed_ms / 1000.0, work_ms / 1000.0, jobs, (jobs == 1)? "" : "s", nrun - nfailed, nfailed, n - nrun);
+}
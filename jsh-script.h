@@ -0,0 +1,38 @@
+/* This file is part of jsh.
+ *
+ * jsh: A basic UNIX shell implementation in C
+ * Copyright (C) 2014 Jo Van Bulck <jo.vanbulck@student.kuleuven.be>
+ *
+ * jsh is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * jsh is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with jsh.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SCRIPT_H_INCLUDED
+#define SCRIPT_H_INCLUDED
+/* ^^ these are the include guards */
+
+#include "jsh-common.h"
+
+/*
+ * run_scripts: run the n script files with the provided paths, each in a forked jsh (that
+ *  inherits the aliases and settings of this one, e.g. from ~/.jshrc, but has its own from
+ *  then on) with stdin from /dev/null, keeping at most jobs scripts running. For more than
+ *  one script, the stdout and stderr of each script are captured and written out with each
+ *  line prefixed by the script's path when it completes, followed by a summary of the
+ *  statuses and durations on stderr.
+ * @return: the exit status of the script (that of its last line) for a single script;
+ *  else EXIT_SUCCESS iff all scripts succeeded, EXIT_FAILURE otherwise
+ */
+int run_scripts(char**, int, int);
+
+#endif //SCRIPT_H_INCLUDED
@@ -0,0 +1,180 @@
+/* This file is part of jsh.
+ *
+ * jsh: A basic UNIX shell implementation in C
+ * Copyright (C) 2014 Jo Van Bulck <jo.vanbulck@student.kuleuven.be>
+ *
+ * jsh is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * jsh is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with jsh.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "jsh-wait.h"
+#include "jsh-zygote.h"
+#include <poll.h>
+#ifdef __linux__
+    #include <sys/syscall.h>
+#endif
+
+#define WAIT_POLL_INTERVAL_MS   10  // fallback polling interval for children without a pidfd
+
+// #################### helper function definitions ####################
+pid_t reap(waitset*, int, int*);
+void remove_child(waitset*, int);
+
+void waitset_init(waitset *ws) {
+    memset(ws, 0, sizeof(waitset));
+    ws->wake_fd = -1;
+}
+
+void waitset_add(waitset *ws, pid_t pid, bool by_zygote) {
+    if (ws->nb == ws->max) {
+        ws->max = ws->max? ws->max*2 : 8;
+        ws->pids = realloc(ws->pids, sizeof(pid_t) * ws->max);
+        ws->pidfds = realloc(ws->pidfds, sizeof(int) * ws->max);
+        ws->by_zygote = realloc(ws->by_zygote, sizeof(bool) * ws->max);
+    }
+    ws->pids[ws->nb] = pid;
+    // note: the zygote reaps its children itself, so only it can open their pidfd without a race
+    ws->pidfds[ws->nb] = by_zygote? zygote_pidfd(pid) : open_pidfd(pid);
+    ws->by_zygote[ws->nb] = by_zygote;
+    ws->nb++;
+}
+
+pid_t waitset_wait(waitset *ws, int *status, long timeout_ms) {
+    if (ws->nb == 0)
+        return -1;
+
+    int i, n, st;
+    long long deadline = (timeout_ms >= 0)? now_ms() + timeout_ms : -1;
+    struct pollfd pfds[ws->nb+2];
+    int index[ws->nb];
+
+    // a single child without pidfd, deadline nor wake_fd can just be waited for; with more
+    //  children, blocking on one of them would leave the slots of the others idle
+    if (ws->failed || (ws->nb == 1 && ws->pidfds[0] == -1 && !ws->by_zygote[0] && deadline < 0 && ws->wake_fd == -1))
+        return reap(ws, 0, status);
+
+    for (;;) {
+        // 1. children without a pidfd can only be checked with a non-blocking waitpid(), or for
+        //  those of the zygote, by checking its exit notifications
+        bool polling = false, by_zygote = false;
+        for (i = 0; i < ws->nb; i++) {
+            if (ws->pidfds[i] != -1)
+                continue;
+            pid_t pid;
+            if (ws->by_zygote[i]) {
+                by_zygote = true;
+                if ((pid = zygote_trywait(ws->pids[i], &st)) < 0) {
+                    printerr("zygote: lost connection with the helper process; assuming %d failed", ws->pids[i]);
+                    errno = ECHILD;
+                }
+            }
+            else {
+                polling = true;
+                pid = waitpid(ws->pids[i], &st, WNOHANG);
+            }
+            if (pid == ws->pids[i] || (pid < 0 && errno == ECHILD)) {
+                if (status) *status = (pid < 0)? WAIT_LOST_STATUS : st;
+                pid = ws->pids[i];
+                remove_child(ws, i);
+                return pid;
+            }
+        }
+
+        // 2. poll the pidfds until the deadline, or a polling interval if needed
+        for (i = 0, n = 0; i < ws->nb; i++)
+            if (ws->pidfds[i] != -1) {
+                pfds[n].fd = ws->pidfds[i];
+                pfds[n].events = POLLIN;
+                pfds[n].revents = 0;
+                index[n++] = i;
+            }
+        int nchildren = n;
+        if (by_zygote && zygote_fd() != -1) {
+            pfds[n].fd = zygote_fd();
+            pfds[n].events = POLLIN;
+            pfds[n++].revents = 0;
+        }
+        int nwake = n;
+        if (ws->wake_fd != -1) {
+            pfds[n].fd = ws->wake_fd;
+            pfds[n].events = POLLIN;
+            pfds[n++].revents = 0;
+        }
+        long long wait_ms = -1;
+        if (deadline >= 0 && (wait_ms = deadline - now_ms()) < 0)
+            wait_ms = 0;
+        if (polling && (wait_ms < 0 || wait_ms > WAIT_POLL_INTERVAL_MS))
+            wait_ms = WAIT_POLL_INTERVAL_MS;
+
+        if (poll(pfds, n, wait_ms) < 0 && errno != EINTR) {
+            printerrno("waiting for child processes failed");
+            ws->failed = true;
+            return WAITSET_FAILED;
+        }
+        for (i = 0; i < nchildren; i++)
+            if (pfds[i].revents)
+                return reap(ws, index[i], status);
+        if (n > nwake && pfds[nwake].revents)
+            return WAITSET_WOKEN;
+        if (deadline >= 0 && now_ms() >= deadline)
+            return 0;
+    }
+}
+
+void waitset_free(waitset *ws) {
+    int i;
+    for (i = 0; i < ws->nb; i++)
+        if (ws->pidfds[i] != -1)
+            close(ws->pidfds[i]);
+    free(ws->pids);
+    free(ws->pidfds);
+    free(ws->by_zygote);
+    waitset_init(ws);
+}
+
+int open_pidfd(pid_t pid) {
+    #ifdef SYS_pidfd_open
+        return syscall(SYS_pidfd_open, pid, 0);   // note: pidfds are always close-on-exec
+    #else
+        errno = ENOSYS;
+        return -1;
+    #endif
+}
+
+/*
+ * reap: (blocking) reap the child at index i of the waitset and remove it from the set
+ * @return: the pid of the reaped child
+ */
+pid_t reap(waitset *ws, int i, int *status) {
+    pid_t pid = ws->pids[i];
+    int st, rv;
+    if (ws->by_zygote[i])
+        rv = zygote_waitpid(pid, &st);
+    else
+        while ((rv = waitpid(pid, &st, 0)) < 0 && errno == EINTR);
+    if (status) *status = (rv < 0)? WAIT_LOST_STATUS : st;
+    remove_child(ws, i);
+    return pid;
+}
+
+/*
+ * remove_child: remove the child at index i from the waitset, closing its pidfd
+ */
+void remove_child(waitset *ws, int i) {
+    if (ws->pidfds[i] != -1)
+        close(ws->pidfds[i]);
+    ws->nb--;
+    ws->pids[i] = ws->pids[ws->nb];
+    ws->pidfds[i] = ws->pidfds[ws->nb];
+    ws->by_zygote[i] = ws->by_zygote[ws->nb];
+}
@@ -0,0 +1,81 @@
+/* This file is part of jsh.
+ *
+ * jsh: A basic UNIX shell implementation in C
+ * Copyright (C) 2014 Jo Van Bulck <jo.vanbulck@student.kuleuven.be>
+ *
+ * jsh is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * jsh is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with jsh.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef WAIT_H_INCLUDED
+#define WAIT_H_INCLUDED
+/* ^^ these are the include guards */
+
+#include "jsh-common.h"
+
+#define WAITSET_WOKEN   -2  // waitset_wait() return value iff its wake_fd is readable
+#define WAITSET_FAILED  -3  // waitset_wait() return value iff waiting failed
+#define WAIT_LOST_STATUS    (EXIT_FAILURE << 8) // status of a child whose exit status was lost
+
+/*
+ * A set of child processes to wait for. On Linux, each child is watched through a pidfd,
+ *  so that waiting for any of them (with an optional deadline) is a single poll() call.
+ */
+struct waitset {
+    pid_t *pids;        // pids of the children that haven't been reaped yet
+    int *pidfds;        // corresponding pidfd, or -1 if pidfd_open() isn't available
+    bool *by_zygote;    // whether or not the child was launched by the zygote helper
+    int nb;             // nb of children in the set
+    int max;            // allocated length of the arrays above
+    int wake_fd;        // if not -1, waitset_wait() also returns when this fd is readable
+    bool failed;        // whether or not waiting failed; waitset_wait() then blocks on each child
+};
+typedef struct waitset waitset;
+
+/*
+ * waitset_init: initialize an empty waitset, without wake_fd
+ */
+void waitset_init(waitset*);
+
+/*
+ * waitset_add: add a child process to the waitset
+ * @arg by_zygote: true iff the process was launched by the zygote helper (and hence
+ *  isn't a child of this process)
+ */
+void waitset_add(waitset*, pid_t, bool);
+
+/*
+ * waitset_wait: wait for any of the children in the waitset to terminate, and remove it
+ *  from the set.
+ * @arg status     : if non-NULL, filled in with the waitpid() status of the child, or
+ *  WAIT_LOST_STATUS if that status was lost (e.g. with the connection to the zygote)
+ * @arg timeout_ms : maximum nb of milliseconds to wait, or -1 to wait without deadline
+ * @return: the pid of the terminated child, 0 on timeout, -1 if the set is empty,
+ *  WAITSET_WOKEN iff the wake_fd of the waitset is readable or WAITSET_FAILED iff poll()
+ *  failed. The caller should then stop launching children: the next calls ignore the
+ *  timeout and wake_fd, and just reap the remaining children one by one with a blocking wait.
+ */
+pid_t waitset_wait(waitset*, int*, long);
+
+/*
+ * waitset_free: free the waitset's memory and close any pidfds left open
+ */
+void waitset_free(waitset*);
+
+/*
+ * open_pidfd: returns a file descriptor referring to the process with the provided pid,
+ *  that becomes readable when the process terminates; or -1 if not supported
+ */
+int open_pidfd(pid_t);
+
+#endif //WAIT_H_INCLUDED
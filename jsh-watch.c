@@ -0,0 +1,393 @@
+/* This file is part of jsh.
+ *
+ * jsh: A basic UNIX shell implementation in C
+ * Copyright (C) 2014 Jo Van Bulck <jo.vanbulck@student.kuleuven.be>
+ *
+ * jsh is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * jsh is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with jsh.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * jsh-watch.c: the watch built_in, a replacement for 'while true; do cmd; sleep 1; done' loops.
+ *  On Linux, the watched directories are registered with inotify and a single poll() waits for
+ *  file changes, termination of the running cmd and ^C together, so the shell sleeps between
+ *  changes and a rerun starts as soon as the debounce period after the last change expired.
+ */
+
+#include "jsh-watch.h"
+#include "jsh-parse.h"
+#include "jsh-wait.h"
+#include "jsh-event.h"
+#include <poll.h>
+#include <signal.h>
+#include <dirent.h>
+#ifdef __linux__
+    #include <sys/inotify.h>
+    #include <sys/signalfd.h>
+#endif
+
+#define WATCH_EVENTS        (IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF)
+#define WATCH_SELF_EVENTS   (IN_ATTRIB | IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)
+#define WATCH_KILL_AFTER_MS 2000    // grace period for a cancelled run to exit on SIGTERM, before SIGKILL
+#define WATCH_POLL_MS       10      // fallback polling interval for a run without a pidfd
+
+// #################### helper function definitions ####################
+#ifdef __linux__
+int add_watches(int, const char*, bool);
+bool read_changes(int);
+bool rewatch(int, int, uint32_t);
+void watch_lost(int, char*);
+bool rewatch_lost(int, int, const char*);
+bool ignored_name(const char*);
+pid_t start_run(char**);
+int finish_run(pid_t, int, long long);
+void cancel_run(pid_t, int);
+
+static char **watched = NULL;   // the path of each inotify watch, indexed by watch descriptor
+static int max_watched = 0;     // allocated length of the watched array
+static char **roots = NULL;     // the paths provided by the user
+static int nb_roots = 0;
+static char **lost = NULL;      // the paths provided by the user that no longer exist
+static int *lost_wd = NULL;     // the watch descriptor of the parent directory of each lost path
+static int nb_lost = 0;
+
+int watch_cmd(char **paths, int npaths, char **cmd, long debounce_ms, bool restart) {
+    int i, st, status = EXIT_SUCCESS, ifd, sigfd, pidfd = -1;
+    if ((ifd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) == -1) {
+        printerrno("watch: couldn't initialize inotify");
+        return EXIT_FAILURE;
+    }
+    roots = paths;
+    nb_roots = npaths;
+    lost = malloc(sizeof(char*) * npaths);
+    lost_wd = malloc(sizeof(int) * npaths);
+    for (i = 0; i < npaths; i++)
+        if (add_watches(ifd, paths[i], true) != EXIT_SUCCESS) {
+            close(ifd);
+            status = EXIT_FAILURE;
+            goto out;
+        }
+    // SIGINT is blocked for the event loop: a second signalfd lets ^C wake up the poll() below
+    sigset_t intmask;
+    sigemptyset(&intmask);
+    sigaddset(&intmask, SIGINT);
+    sigfd = signalfd(-1, &intmask, SFD_NONBLOCK | SFD_CLOEXEC);
+    
+    fflush(stdout);
+    long long start_ms = now_ms(), deadline_ms = -1;
+    pid_t run = start_run(cmd);
+    if (run != -1)
+        pidfd = open_pidfd(run);
+    while (true) {
+        // wait for a change, the end of the run, ^C or the end of the debounce period
+        long long now = now_ms();
+        long timeout = (deadline_ms < 0)? -1 : (deadline_ms > now)? deadline_ms - now : 0;
+        if (run != -1 && pidfd == -1 && (timeout < 0 || timeout > WATCH_POLL_MS))
+            timeout = WATCH_POLL_MS;
+        // note: the children watched by the event loop (e.g. queued tasks) are serviced meanwhile
+        struct pollfd pfds[4] = {{ifd, POLLIN, 0}, {sigfd, POLLIN, 0}, {pidfd, POLLIN, 0},
+            {I_AM_FORK? -1 : event_children_fd(), POLLIN, 0}};
+        if (poll(pfds, 4, timeout) < 0 && errno != EINTR) {
+            printerrno("watch: waiting for changes failed");
+            break;
+        }
+        if (event_interrupted()) {
+            if (run != -1)
+                cancel_run(run, SIGINT);
+            break;
+        }
+        if (pfds[3].revents & POLLIN)
+            event_reap_children();
+        // note: unless restart, the changes made while the cmd runs (e.g. by the cmd itself) are ignored
+        if ((pfds[0].revents & POLLIN) && read_changes(ifd) && (run == -1 || restart)) {
+            printdebug("watch: change detected; rerunning in %ldms", debounce_ms);
+            deadline_ms = now_ms() + debounce_ms;
+        }
+        if (run != -1 && (pidfd == -1 || (pfds[2].revents & POLLIN)) && (st = finish_run(run, WNOHANG, start_ms)) != -1) {
+            status = st;
+            run = -1;
+            if (pidfd != -1)
+                close(pidfd);
+            pidfd = -1;
+            if (!restart)
+                read_changes(ifd);  // the events of the run's last writes are queued by now
+        }
+        if (deadline_ms >= 0 && now_ms() >= deadline_ms) {
+            if (run != -1) {
+                printerr("watch: files changed; cancelling the running cmd");
+                cancel_run(run, SIGTERM);
+                if (pidfd != -1)
+                    close(pidfd);
+                pidfd = -1;
+            }
+            deadline_ms = -1;
+            start_ms = now_ms();
+            if ((run = start_run(cmd)) != -1)
+                pidfd = open_pidfd(run);
+        }
+    }
+    if (pidfd != -1)
+        close(pidfd);
+    if (sigfd != -1)
+        close(sigfd);
+    close(ifd);
+out:
+    free(lost);
+    free(lost_wd);
+    lost = NULL;
+    nb_lost = 0;
+    for (i = 0; i < max_watched; i++)
+        free(watched[i]);
+    free(watched);
+    watched = NULL;
+    max_watched = 0;
+    return status;
+}
+
+/*
+ * add_watches: add an inotify watch for the provided path and, if it is a directory, for all
+ *  its subdirectories that aren't hidden
+ * @arg explicit: true iff the path was provided by the user, and hence should exist
+ * @return: EXIT_SUCCESS or EXIT_FAILURE
+ */
+int add_watches(int ifd, const char *path, bool explicit) {
+    struct stat st;
+    if (stat(path, &st) != 0) {
+        if (explicit)
+            printerrno("watch: couldn't watch '%s'", path);
+        return explicit? EXIT_FAILURE : EXIT_SUCCESS;
+    }
+    // note: the link count of a watched file drops when e.g. an editor renames a new file over it
+    int wd = inotify_add_watch(ifd, path, WATCH_EVENTS | (S_ISDIR(st.st_mode)? 0 : IN_ATTRIB));
+    if (wd == -1) {
+        printerrno("watch: couldn't watch '%s'%s", path, (errno == ENOSPC)? " (see /proc/sys/fs/inotify/max_user_watches)" : "");
+        return EXIT_FAILURE;
+    }
+    if (wd >= max_watched) {
+        int old = max_watched;
+        max_watched = (wd < 2*max_watched)? 2*max_watched : wd + 16;
+        watched = realloc(watched, sizeof(char*) * max_watched);
+        memset(watched + old, 0, sizeof(char*) * (max_watched - old));
+    }
+    free(watched[wd]);
+    watched[wd] = strclone(path);
+    if (!S_ISDIR(st.st_mode))
+        return EXIT_SUCCESS;
+    
+    DIR *dir = opendir(path);
+    struct dirent *ent;
+    int rv = EXIT_SUCCESS;
+    while (dir != NULL && rv == EXIT_SUCCESS && (ent = readdir(dir)) != NULL) {
+        if (*ent->d_name == '.' || (ent->d_type != DT_DIR && ent->d_type != DT_UNKNOWN))
+            continue;
+        char *sub = concat(3, path, "/", ent->d_name);
+        if (ent->d_type == DT_DIR || (stat(sub, &st) == 0 && S_ISDIR(st.st_mode)))
+            rv = add_watches(ifd, sub, false);
+        free(sub);
+    }
+    if (dir != NULL)
+        closedir(dir);
+    return rv;
+}
+
+/*
+ * read_changes: read the pending inotify events, watching newly created directories and
+ *  rewatching paths whose file was replaced
+ * @return: true iff any of the events is a change of a file that isn't ignored_name()
+ */
+bool read_changes(int ifd) {
+    char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+    bool changed = false;
+    ssize_t len, i;
+    while ((len = read(ifd, buf, sizeof(buf))) > 0)
+        for (i = 0; i < len; i += sizeof(struct inotify_event) + ((struct inotify_event*) (buf+i))->len) {
+            struct inotify_event *ev = (struct inotify_event*) (buf+i);
+            if (ev->mask & IN_Q_OVERFLOW) {
+                changed = true;
+                continue;
+            }
+            if (ev->len == 0 && (ev->mask & WATCH_SELF_EVENTS)) {
+                changed = rewatch(ifd, ev->wd, ev->mask) || changed;
+                continue;
+            }
+            // note: before ignored_name(), since the user may explicitly watch e.g. a hidden file
+            if ((ev->mask & (IN_CREATE | IN_MOVED_TO)) && rewatch_lost(ifd, ev->wd, ev->name)) {
+                changed = true;
+                continue;
+            }
+            // e.g. an unrelated entry in the parent directory of a lost path
+            if (ev->wd >= max_watched || watched[ev->wd] == NULL || ignored_name(ev->name))
+                continue;
+            if ((ev->mask & (IN_CREATE | IN_MOVED_TO)) && (ev->mask & IN_ISDIR) && ev->wd < max_watched && watched[ev->wd]) {
+                char *sub = concat(3, watched[ev->wd], "/", ev->name);
+                add_watches(ifd, sub, false);
+                free(sub);
+            }
+            // a new empty file or directory isn't a change worth a rerun; its first write is
+            changed = changed || !(ev->mask & IN_CREATE) || (ev->mask & IN_ISDIR);
+            printdebug("watch: event 0x%x for '%s/%s'", ev->mask, (ev->wd < max_watched && watched[ev->wd])? watched[ev->wd] : "?", ev->len? ev->name : "");
+        }
+    return changed;
+}
+
+/*
+ * rewatch: check whether the path of the provided watch still refers to the watched file after
+ *  the provided self event, and if not, move the watch to the file now at that path, or if none
+ *  and the path was provided by the user, wait for it to reappear with watch_lost()
+ * @return: true iff the path no longer refers to the watched file
+ */
+bool rewatch(int ifd, int wd, uint32_t mask) {
+    if (wd >= max_watched || watched[wd] == NULL)
+        return false;   // e.g. the IN_IGNORED of a watch removed below
+    char *path = watched[wd];
+    int new_wd = (mask & (IN_DELETE_SELF | IN_IGNORED))? -1 : inotify_add_watch(ifd, path, IN_MASK_ADD | IN_MOVE_SELF);
+    if (new_wd == wd)
+        return false;   // e.g. chmod
+    watched[wd] = NULL;
+    if (!(mask & IN_IGNORED))
+        inotify_rm_watch(ifd, wd);
+    struct stat st;
+    int i;
+    if (stat(path, &st) == 0) {
+        printdebug("watch: '%s' was replaced; rewatching", path);
+        add_watches(ifd, path, false);
+    }
+    else
+        for (i = 0; i < nb_roots; i++)
+            if (strcmp(roots[i], path) == 0) {
+                watch_lost(ifd, roots[i]);
+                break;
+            }
+    free(path);
+    return true;
+}
+
+/*
+ * watch_lost: watch the parent directory of the provided path, provided by the user, that no
+ *  longer exists, to rewatch it once it is recreated (e.g. by an editor that renamed it away)
+ */
+void watch_lost(int ifd, char *path) {
+    int i;
+    for (i = 0; i < nb_lost; i++)
+        if (lost[i] == path)
+            return;
+    char *slash = strrchr(path, '/');
+    char *parent = (slash == NULL)? strclone(".") : (slash == path)? strclone("/") : strndup(path, slash - path);
+    // note: IN_MASK_ADD, as the parent directory may be watched itself
+    int wd = inotify_add_watch(ifd, parent, IN_CREATE | IN_MOVED_TO | IN_MASK_ADD);
+    if (wd == -1)
+        printerrno("watch: '%s' was removed, and its directory '%s' can't be watched; no longer watching it", path, parent);
+    else {
+        fprintf(stderr, "watch: '%s' was removed; waiting for it to reappear\n", path);
+        lost[nb_lost] = path;
+        lost_wd[nb_lost++] = wd;
+    }
+    free(parent);
+}
+
+/*
+ * rewatch_lost: rewatch the lost path with the provided name in the directory of the provided
+ *  watch, if any, now an entry with that name was created or moved there
+ * @return: true iff a lost path was rewatched
+ */
+bool rewatch_lost(int ifd, int wd, const char *name) {
+    struct stat st;
+    int i;
+    for (i = 0; i < nb_lost; i++) {
+        char *slash = strrchr(lost[i], '/');
+        if (lost_wd[i] != wd || strcmp(slash? slash+1 : lost[i], name) != 0)
+            continue;
+        if (stat(lost[i], &st) != 0)
+            return false;   // already gone again
+        printdebug("watch: '%s' reappeared; rewatching", lost[i]);
+        if (add_watches(ifd, lost[i], true) != EXIT_SUCCESS)
+            printerr("watch: no longer watching '%s'", lost[i]);
+        lost[i] = lost[--nb_lost];
+        lost_wd[i] = lost_wd[nb_lost];
+        return true;
+    }
+    return false;
+}
+
+/*
+ * ignored_name: returns whether or not changes of the file with the provided name should be
+ *  ignored: hidden files (e.g. editor swap files) and backup files ending in '~'
+ */
+bool ignored_name(const char *name) {
+    size_t len = strlen(name);
+    return *name == '.' || (len > 0 && name[len-1] == '~');
+}
+
+/*
+ * start_run: fork a child in a new process group that runs the cmd (with stdin from /dev/null),
+ *  so that a cancelled run can be killed as a whole
+ * @return: the pid of the child, or -1 on failure
+ */
+pid_t start_run(char **cmd) {
+    pid_t pid = fork();
+    if (pid == 0) {
+        I_AM_FORK = true;
+        setpgid(0, 0);
+        event_restore_sigmask();
+        int in = open("/dev/null", O_RDONLY);
+        REDIRECT_STR(in, STDIN_FILENO);
+        if (cmd[1] == NULL)
+            exit_fork(parse_from_file(strclone(*cmd)));
+        exit_fork(execute_cmd(cmd));
+    }
+    if (pid == -1)
+        printerrno("watch: couldn't launch '%s'", *cmd);
+    else
+        setpgid(pid, pid);  // avoid a race with the child's setpgid()
+    return pid;
+}
+
+/*
+ * finish_run: reap the provided run and report its exit status
+ * @arg options: waitpid() options, e.g. WNOHANG
+ * @return: the exit status of the run, or -1 if it didn't terminate (yet)
+ */
+int finish_run(pid_t run, int options, long long start_ms) {
+    int st;
+    if (waitpid(run, &st, options) != run)
+        return -1;
+    int status = WIFEXITED(st)? WEXITSTATUS(st) : 128 + WTERMSIG(st);
+    fprintf(stderr, "watch: exit status %d after %.2fs; waiting for changes\n", status, (now_ms() - start_ms) / 1000.0);
+    return status;
+}
+
+/*
+ * cancel_run: send the provided signal to the process group of the provided run, followed by
+ *  SIGKILL if it didn't exit within WATCH_KILL_AFTER_MS, and reap it
+ */
+void cancel_run(pid_t run, int sig) {
+    kill(-run, sig);
+    long long deadline = now_ms() + WATCH_KILL_AFTER_MS;
+    while (waitpid(run, NULL, WNOHANG) == 0) {
+        if (now_ms() >= deadline) {
+            kill(-run, SIGKILL);
+            waitpid(run, NULL, 0);
+            break;
+        }
+        poll(NULL, 0, WATCH_POLL_MS);
+    }
+    // kill any remaining processes of the cancelled run, e.g. those its shell didn't wait for
+    kill(-run, SIGKILL);
+}
+
+#else
+int watch_cmd(char **paths, int npaths, char **cmd, long debounce_ms, bool restart) {
+    printerr("watch: needs inotify, which isn't available on this platform");
+    return EXIT_FAILURE;
+}
+#endif
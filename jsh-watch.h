@@ -0,0 +1,40 @@
+/* This file is part of jsh.
+ *
+ * jsh: A basic UNIX shell implementation in C
+ * Copyright (C) 2014 Jo Van Bulck <jo.vanbulck@student.kuleuven.be>
+ *
+ * jsh is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * jsh is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with jsh.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef WATCH_H_INCLUDED
+#define WATCH_H_INCLUDED
+/* ^^ these are the include guards */
+
+#include "jsh-common.h"
+
+#define WATCH_DEBOUNCE_MS   100     // default quiet period after a change, before the cmd is rerun
+
+/*
+ * watch_cmd: run the NULL terminated cmd array (a single argument is parsed as a cmd line)
+ *  and rerun it whenever a file under one of the npaths paths changes, until ^C. Directories
+ *  are watched recursively (skipping hidden ones) with inotify, so nothing runs between
+ *  changes. A rerun starts once no further changes arrived for debounce_ms. Changes made
+ *  while the cmd runs, like the build outputs of 'watch src -- make', are ignored; iff restart,
+ *  they cancel the run in progress instead, and rerun it (so the cmd shouldn't write there).
+ * @return: the exit status of the last completed run, or EXIT_FAILURE if the paths couldn't
+ *  be watched
+ */
+int watch_cmd(char**, int, char**, long, bool);
+
+#endif //WATCH_H_INCLUDED
@@ -0,0 +1,576 @@
+/* This file is part of jsh.
+ *
+ * jsh: A basic UNIX shell implementation in C
+ * Copyright (C) 2014 Jo Van Bulck <jo.vanbulck@student.kuleuven.be>
+ *
+ * jsh is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * jsh is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with jsh.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * ----------------------------------------------------------------------
+ * jsh-zygote.c: an optional fork server. At startup, while the shell's address space is
+ *  still small, jsh forks a helper process (the zygote) connected over a UNIX socket pair.
+ *  execute() then hands the zygote the argv, redirections, environment changes and the
+ *  file descriptors (SCM_RIGHTS) of a pipeline stage; the zygote does the fork/exec, so
+ *  the cost of launching a command no longer grows with the interactive shell's heap.
+ *
+ * protocol  :  shell  -> zygote : struct zyg_req + string payload + fds {cwd, in, out, err}
+ *              zygote -> shell  : struct zyg_msg {ZYG_SPAWNED, pid} + pidfd (if any) as reply to each request
+ *                                 struct zyg_msg {ZYG_EXITED, pid, status} on child termination
+ * ----------------------------------------------------------------------
+ */
+
+#include "jsh-zygote.h"
+#include "jsh-event.h"
+#include "jsh-wait.h"
+#include <signal.h>
+#include <poll.h>
+#include <sys/socket.h>
+
+#define ZYG_NB_FDS          4       // fds passed with each request: cwd, stdin, stdout, stderr
+#define ZYG_CWD             0
+#define ZYG_IN              1
+#define ZYG_OUT             2
+#define ZYG_ERR             3
+
+#define ZYG_APPEND_OUT      0x1     // request flags
+#define ZYG_PIPE_IN         0x2
+#define ZYG_PIPE_OUT        0x4
+
+#define ZYG_SPAWNED         1       // message types sent back by the zygote
+#define ZYG_EXITED          2
+
+#ifdef MSG_NOSIGNAL
+    #define ZYG_SEND_FLAGS  MSG_NOSIGNAL    // don't get killed by SIGPIPE when the zygote died
+#else
+    #define ZYG_SEND_FLAGS  0
+#endif
+
+struct zyg_req {
+    int nbytes;         // length of the string payload following the header
+    int argc;           // nb of argv strings at the start of the payload
+    int nenv;           // nb of environment delta strings at the end of the payload
+    int flags;          // ZYG_* request flags
+};
+
+struct zyg_msg {
+    int type;           // ZYG_SPAWNED or ZYG_EXITED
+    pid_t pid;          // pid of the spawned / exited process; -1 if spawning failed
+    int status;         // waitpid() status of the exited process
+};
+
+// #################### helper function definitions ####################
+int read_full(int, void*, size_t);
+int send_with_fds(int, void*, size_t, int*, int);
+int recv_with_fds(int, void*, size_t, int*, int);
+void payload_add(char**, size_t*, const char*, size_t);
+char *env_deltas(char*, size_t*, int*);
+void zygote_loop(int);
+int zygote_handle_req(int);
+void zygote_exec(struct zyg_req*, char*, int*);
+void zygote_reap(int);
+void zygote_sigchld_handler(int);
+int zygote_read_msg(struct zyg_msg*, int*);
+void zygote_stash(struct zyg_msg*);
+bool zygote_claim(pid_t, int*);
+void zygote_exited(pid_t, int, void*);
+
+bool USE_ZYGOTE = false;
+
+static int zyg_sock = -1;               // shell side of the socket pair; -1 if no zygote
+static char **zyg_env = NULL;           // copy of the environment the zygote was forked with
+static struct zyg_msg *pending = NULL;  // received, not yet claimed exit notifications
+static int nb_pending = 0;
+static int max_pending = 0;
+static struct zyg_msg *spawned = NULL;  // the launched processes with a not yet claimed pidfd (in .status)
+static int nb_spawned = 0;
+static int max_spawned = 0;
+static int sigchld_pipe[2] = {-1, -1};  // zygote self-pipe, written to on SIGCHLD
+
+// #################### shell side ####################
+
+int zygote_start(void) {
+    // the launched processes are waited for on pidfds, opened by the zygote before it can reap them
+    int sv[2], pidfd = open_pidfd(getpid());
+    if (pidfd == -1 && errno == ENOSYS) {
+        printdebug("zygote: pidfds aren't supported; not starting the helper process");
+        return EXIT_FAILURE;
+    }
+    if (pidfd != -1)
+        close(pidfd);
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+        printerrno("zygote: couldn't create socket pair");
+        return EXIT_FAILURE;
+    }
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == -1) {
+        printerrno("zygote: couldn't fork the helper process");
+        close(sv[0]);
+        close(sv[1]);
+        return EXIT_FAILURE;
+    }
+    else if (pid == 0) {
+        I_AM_FORK = true;
+        close(sv[0]);
+        zygote_loop(sv[1]);
+        _exit(EXIT_SUCCESS);
+    }
+    close(sv[1]);
+    fcntl(sv[0], F_SETFD, FD_CLOEXEC);
+    zyg_sock = sv[0];
+
+    // remember the environment the zygote inherited, to only send deltas afterwards
+    extern char **environ;
+    int i, n;
+    for (n = 0; environ[n]; n++);
+    zyg_env = malloc(sizeof(char*) * (n+1));
+    for (i = 0; i < n; i++)
+        zyg_env[i] = strclone(environ[i]);
+    zyg_env[n] = NULL;
+
+    event_watch_pid(pid, zygote_exited, NULL);
+    printdebug("zygote: helper process started with pid %d", pid);
+    return EXIT_SUCCESS;
+}
+
+pid_t zygote_spawn(comd *cmd, int stdinfd, int stdoutfd) {
+    // forked children (e.g. a subshell) must not share the socket with the shell
+    if (zyg_sock == -1 || I_AM_FORK)
+        return -1;
+
+    struct zyg_req req = {0, 0, 0, 0};
+    char *payload = NULL;
+    size_t len = 0;
+    // note: cmd->length also counts redirection operators; argv ends at the first NULL
+    for (req.argc = 0; cmd->cmd[req.argc] != NULL; req.argc++)
+        payload_add(&payload, &len, cmd->cmd[req.argc], strlen(cmd->cmd[req.argc]));
+    payload_add(&payload, &len, cmd->inf? cmd->inf : "", cmd->inf? strlen(cmd->inf) : 0);
+    payload_add(&payload, &len, cmd->outf? cmd->outf : "", cmd->outf? strlen(cmd->outf) : 0);
+    payload_add(&payload, &len, cmd->errf? cmd->errf : "", cmd->errf? strlen(cmd->errf) : 0);
+    payload = env_deltas(payload, &len, &req.nenv);
+    req.nbytes = len;
+    if (cmd->append_out)   req.flags |= ZYG_APPEND_OUT;
+    if (stdinfd != -1)     req.flags |= ZYG_PIPE_IN;
+    if (stdoutfd != -1)    req.flags |= ZYG_PIPE_OUT;
+
+    int fds[ZYG_NB_FDS];
+    fds[ZYG_CWD] = open(".", O_RDONLY);
+    fds[ZYG_IN] = (stdinfd != -1)? stdinfd : STDIN_FILENO;
+    fds[ZYG_OUT] = (stdoutfd != -1)? stdoutfd : STDOUT_FILENO;
+    fds[ZYG_ERR] = STDERR_FILENO;
+    if (fds[ZYG_CWD] < 0) {
+        printdebug("zygote: couldn't open the cwd; falling back to fork");
+        free(payload);
+        return -1;
+    }
+
+    // send the header with the fds attached, followed by the payload
+    int rv = send_with_fds(zyg_sock, &req, sizeof(req), fds, ZYG_NB_FDS);
+    if (rv == EXIT_SUCCESS && len)
+        rv = send_with_fds(zyg_sock, payload, len, NULL, 0);
+    close(fds[ZYG_CWD]);
+    free(payload);
+
+    // wait for the reply, stashing any exit notifications that arrive first
+    struct zyg_msg msg;
+    int pidfd;
+    while (rv == EXIT_SUCCESS && (rv = zygote_read_msg(&msg, &pidfd)) == EXIT_SUCCESS) {
+        if (msg.type == ZYG_SPAWNED) {
+            printdebug("zygote: launched '%s' with pid %d (pidfd %d)", *cmd->cmd, msg.pid, pidfd);
+            if (pidfd != -1) {
+                fcntl(pidfd, F_SETFD, FD_CLOEXEC);
+                if (nb_spawned == max_spawned) {
+                    max_spawned = max_spawned? max_spawned*2 : 8;
+                    spawned = realloc(spawned, sizeof(struct zyg_msg) * max_spawned);
+                }
+                spawned[nb_spawned++] = (struct zyg_msg) {ZYG_SPAWNED, msg.pid, pidfd};
+            }
+            return msg.pid;
+        }
+        zygote_stash(&msg);
+    }
+    printerr("zygote: lost connection with the helper process; falling back to fork");
+    close(zyg_sock);
+    zyg_sock = -1;
+    return -1;
+}
+
+int zygote_pidfd(pid_t pid) {
+    int i, pidfd;
+    for (i = 0; i < nb_spawned; i++)
+        if (spawned[i].pid == pid) {
+            pidfd = spawned[i].status;
+            spawned[i] = spawned[--nb_spawned];
+            return pidfd;
+        }
+    return -1;
+}
+
+int zygote_fd(void) {
+    return zyg_sock;
+}
+
+pid_t zygote_trywait(pid_t pid, int *status) {
+    struct zyg_msg msg;
+    struct pollfd pfd = {zyg_sock, POLLIN, 0};
+    // note: each message is sent at once, so a readable socket holds a whole one (or EOF)
+    while (zyg_sock != -1 && poll(&pfd, 1, 0) > 0) {
+        if (zygote_read_msg(&msg, NULL) != EXIT_SUCCESS)
+            return zygote_claim(pid, status)? pid : -1;
+        zygote_stash(&msg);
+    }
+    if (zygote_claim(pid, status))
+        return pid;
+    return (zyg_sock == -1)? -1 : 0;
+}
+
+pid_t zygote_waitpid(pid_t pid, int *status) {
+    if (zygote_claim(pid, status))
+        return pid;
+
+    struct zyg_msg msg;
+    while (zyg_sock != -1 && zygote_read_msg(&msg, NULL) == EXIT_SUCCESS) {
+        if (msg.type == ZYG_EXITED && msg.pid == pid) {
+            if (status) *status = msg.status;
+            return pid;
+        }
+        zygote_stash(&msg);
+    }
+    printerr("zygote: lost connection with the helper process while waiting for %d", pid);
+    return -1;
+}
+
+/*
+ * zygote_read_msg: blocking read of the next message sent by the zygote
+ * @arg pidfd: if non-NULL, set to the pidfd sent with the message, or -1; else it is closed
+ * @return: EXIT_SUCCESS or EXIT_FAILURE on EOF / error
+ */
+int zygote_read_msg(struct zyg_msg *msg, int *pidfd) {
+    int fd;
+    if (recv_with_fds(zyg_sock, msg, sizeof(struct zyg_msg), &fd, 1) != EXIT_SUCCESS)
+        return EXIT_FAILURE;
+    if (pidfd)
+        *pidfd = fd;
+    else if (fd != -1)
+        close(fd);
+    return EXIT_SUCCESS;
+}
+
+/*
+ * zygote_claim: look up the stashed exit notification of the provided process and remove it
+ * @return: true iff it was found, filling in @param(status)
+ */
+bool zygote_claim(pid_t pid, int *status) {
+    int i;
+    for (i = 0; i < nb_pending; i++)
+        if (pending[i].pid == pid) {
+            if (status) *status = pending[i].status;
+            pending[i] = pending[--nb_pending];
+            return true;
+        }
+    return false;
+}
+
+/*
+ * zygote_stash: remember an exit notification until zygote_waitpid() claims it
+ */
+void zygote_stash(struct zyg_msg *msg) {
+    if (msg->type != ZYG_EXITED)
+        return;
+    if (nb_pending == max_pending) {
+        max_pending = max_pending? max_pending*2 : 8;
+        pending = realloc(pending, sizeof(struct zyg_msg) * max_pending);
+    }
+    pending[nb_pending++] = *msg;
+}
+
+/*
+ * zygote_exited: event loop callback for the termination of the zygote helper itself
+ */
+void zygote_exited(pid_t pid, int status, void *arg) {
+    printerr("zygote: helper process %d exited; falling back to fork", pid);
+    if (zyg_sock != -1)
+        close(zyg_sock);
+    zyg_sock = -1;
+}
+
+/*
+ * env_deltas: append the environment changes since the zygote was started to the payload:
+ *  "NAME=VALUE" for new or changed variables and "NAME" for removed ones.
+ * @return: the (possibly realloced) payload; @param(nenv) is set to the nb of deltas
+ */
+char *env_deltas(char *payload, size_t *len, int *nenv) {
+    extern char **environ;
+    char **e, **z;
+    *nenv = 0;
+    for (e = environ; *e; e++) {
+        for (z = zyg_env; *z && strcmp(*z, *e) != 0; z++);
+        if (!*z) {
+            payload_add(&payload, len, *e, strlen(*e));
+            (*nenv)++;
+        }
+    }
+    for (z = zyg_env; *z; z++) {
+        size_t namelen = strcspn(*z, "=");
+        for (e = environ; *e && !(strncmp(*e, *z, namelen) == 0 && (*e)[namelen] == '='); e++);
+        if (!*e) {
+            payload_add(&payload, len, *z, namelen);
+            (*nenv)++;
+        }
+    }
+    return payload;
+}
+
+/*
+ * payload_add: append the first n chars of s and a '\0' to the malloced payload buffer
+ */
+void payload_add(char **payload, size_t *len, const char *s, size_t n) {
+    *payload = realloc(*payload, *len + n + 1);
+    memcpy(*payload + *len, s, n);
+    (*payload)[*len + n] = '\0';
+    *len += n + 1;
+}
+
+// #################### zygote side ####################
+
+/*
+ * zygote_loop: main loop of the zygote helper: serve spawn requests and report
+ *  the termination of launched processes, until the shell closes the socket.
+ */
+void zygote_loop(int sock) {
+    event_restore_sigmask();
+    signal(SIGINT, SIG_IGN);    // ^C is meant for the launched commands, not for the zygote
+    if (pipe(sigchld_pipe) < 0)
+        _exit(EXIT_FAILURE);
+    fcntl(sigchld_pipe[0], F_SETFD, FD_CLOEXEC);
+    fcntl(sigchld_pipe[1], F_SETFD, FD_CLOEXEC);
+    fcntl(sigchld_pipe[1], F_SETFL, O_NONBLOCK);
+    fcntl(sock, F_SETFD, FD_CLOEXEC);
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = zygote_sigchld_handler;
+    sa.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+    sigaction(SIGCHLD, &sa, NULL);
+
+    struct pollfd pfds[2] = {{sock, POLLIN, 0}, {sigchld_pipe[0], POLLIN, 0}};
+    for (;;) {
+        if (poll(pfds, 2, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            _exit(EXIT_FAILURE);
+        }
+        if (pfds[1].revents & POLLIN) {
+            char buf[64];
+            read(sigchld_pipe[0], buf, sizeof(buf));
+            zygote_reap(sock);
+        }
+        if (pfds[0].revents & (POLLIN | POLLHUP | POLLERR))
+            if (zygote_handle_req(sock) != EXIT_SUCCESS)
+                _exit(EXIT_SUCCESS);    // the shell exited
+    }
+}
+
+/*
+ * zygote_handle_req: read the next spawn request from the socket and fork/exec it
+ * @return: EXIT_FAILURE iff the socket was closed
+ */
+int zygote_handle_req(int sock) {
+    struct zyg_req req;
+    int i, fds[ZYG_NB_FDS];
+    if (recv_with_fds(sock, &req, sizeof(req), fds, ZYG_NB_FDS) != EXIT_SUCCESS)
+        return EXIT_FAILURE;
+
+    char *payload = malloc(req.nbytes + 1);
+    if (read_full(sock, payload, req.nbytes) != EXIT_SUCCESS)
+        return EXIT_FAILURE;
+
+    struct zyg_msg msg = {ZYG_SPAWNED, fork(), 0};
+    if (msg.pid == 0)
+        zygote_exec(&req, payload, fds);
+    for (i = 0; i < ZYG_NB_FDS; i++)
+        close(fds[i]);
+    free(payload);
+
+    // the SPAWNED reply always precedes the EXITED message, since reaping happens in the loop;
+    //  for the same reason, the pidfd sent along can't refer to another process with a reused pid
+    int pidfd = (msg.pid > 0)? open_pidfd(msg.pid) : -1;
+    int rv = send_with_fds(sock, &msg, sizeof(msg), &pidfd, (pidfd != -1)? 1 : 0);
+    if (pidfd != -1)
+        close(pidfd);
+    return rv;
+}
+
+/*
+ * zygote_exec: executed in the newly forked child: apply the cwd, environment and
+ *  redirections of the request and exec the command.
+ */
+void zygote_exec(struct zyg_req *req, char *payload, int *fds) {
+    signal(SIGINT, SIG_DFL);
+    signal(SIGCHLD, SIG_DFL);
+    close(sigchld_pipe[0]);
+    close(sigchld_pipe[1]);
+
+    // unpack the payload: argv, the redirection files and the environment deltas
+    char **argv = malloc(sizeof(char*) * (req->argc + 1));
+    char *p = payload;
+    int i;
+    for (i = 0; i < req->argc; i++, p += strlen(p) + 1)
+        argv[i] = p;
+    argv[i] = NULL;
+
+    comd cmd;
+    memset(&cmd, 0, sizeof(cmd));
+    cmd.cmd = argv;
+    cmd.length = req->argc;
+    cmd.inf = *p? p : NULL;     p += strlen(p) + 1;
+    cmd.outf = *p? p : NULL;    p += strlen(p) + 1;
+    cmd.errf = *p? p : NULL;    p += strlen(p) + 1;
+    cmd.append_out = (req->flags & ZYG_APPEND_OUT)? 1 : 0;
+
+    for (i = 0; i < req->nenv; i++, p += strlen(p) + 1)
+        if (strchr(p, '='))
+            putenv(p);
+        else
+            unsetenv(p);
+
+    if (fchdir(fds[ZYG_CWD]) < 0)
+        printerrno("zygote: couldn't change to the shell's working directory");
+
+    // pipe redirection keeps its priority over explicit redirection
+    REDIRECT_STR(fds[ZYG_ERR], STDERR_FILENO);
+    if (!(req->flags & ZYG_PIPE_IN))
+        REDIRECT_STR(fds[ZYG_IN], STDIN_FILENO);
+    if (!(req->flags & ZYG_PIPE_OUT))
+        REDIRECT_STR(fds[ZYG_OUT], STDOUT_FILENO);
+    redirectstreams(&cmd, (req->flags & ZYG_PIPE_IN)? fds[ZYG_IN] : -1,
+        (req->flags & ZYG_PIPE_OUT)? fds[ZYG_OUT] : -1);
+    for (i = 0; i < ZYG_NB_FDS; i++)
+        if (fds[i] > STDERR_FILENO)
+            close(fds[i]);
+
+    execvp(*argv, argv);
+    print_exec_error(*argv);
+    _exit(EXIT_FAILURE);
+}
+
+/*
+ * zygote_reap: reap all terminated children and notify the shell
+ */
+void zygote_reap(int sock) {
+    struct zyg_msg msg = {ZYG_EXITED, 0, 0};
+    while ((msg.pid = waitpid(-1, &msg.status, WNOHANG)) > 0)
+        send(sock, &msg, sizeof(msg), ZYG_SEND_FLAGS);
+}
+
+void zygote_sigchld_handler(int signo) {
+    int saved_errno = errno;
+    write(sigchld_pipe[1], "c", 1);
+    errno = saved_errno;
+}
+
+// #################### socket helper functions ####################
+
+/*
+ * read_full: read exactly len bytes from fd, restarting on interrupts
+ * @return: EXIT_SUCCESS or EXIT_FAILURE on EOF / error
+ */
+int read_full(int fd, void *buf, size_t len) {
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = read(fd, (char*) buf + done, len - done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return EXIT_FAILURE;
+        done += n;
+    }
+    return EXIT_SUCCESS;
+}
+
+/*
+ * send_with_fds: send len bytes over the socket, with nfds file descriptors attached
+ *  as SCM_RIGHTS ancillary data to the first chunk.
+ * @return: EXIT_SUCCESS or EXIT_FAILURE
+ */
+int send_with_fds(int sock, void *buf, size_t len, int *fds, int nfds) {
+    union {
+        struct cmsghdr hdr;
+        char buf[CMSG_SPACE(sizeof(int) * ZYG_NB_FDS)];
+    } ctrl;
+    size_t done = 0;
+    while (done < len) {
+        struct iovec iov = {(char*) buf + done, len - done};
+        struct msghdr mh;
+        memset(&mh, 0, sizeof(mh));
+        mh.msg_iov = &iov;
+        mh.msg_iovlen = 1;
+        if (nfds && done == 0) {
+            memset(&ctrl, 0, sizeof(ctrl));
+            mh.msg_control = ctrl.buf;
+            mh.msg_controllen = CMSG_SPACE(sizeof(int) * nfds);
+            struct cmsghdr *cm = CMSG_FIRSTHDR(&mh);
+            cm->cmsg_level = SOL_SOCKET;
+            cm->cmsg_type = SCM_RIGHTS;
+            cm->cmsg_len = CMSG_LEN(sizeof(int) * nfds);
+            memcpy(CMSG_DATA(cm), fds, sizeof(int) * nfds);
+        }
+        ssize_t n = sendmsg(sock, &mh, ZYG_SEND_FLAGS);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return EXIT_FAILURE;
+        done += n;
+    }
+    return EXIT_SUCCESS;
+}
+
+/*
+ * recv_with_fds: receive exactly len bytes from the socket, together with the nfds
+ *  file descriptors attached to them. Missing fds are set to -1.
+ * @return: EXIT_SUCCESS or EXIT_FAILURE on EOF / error
+ */
+int recv_with_fds(int sock, void *buf, size_t len, int *fds, int nfds) {
+    union {
+        struct cmsghdr hdr;
+        char buf[CMSG_SPACE(sizeof(int) * ZYG_NB_FDS)];
+    } ctrl;
+    int i;
+    for (i = 0; i < nfds; i++)
+        fds[i] = -1;
+
+    size_t done = 0;
+    while (done < len) {
+        struct iovec iov = {(char*) buf + done, len - done};
+        struct msghdr mh;
+        memset(&mh, 0, sizeof(mh));
+        mh.msg_iov = &iov;
+        mh.msg_iovlen = 1;
+        mh.msg_control = ctrl.buf;
+        mh.msg_controllen = sizeof(ctrl.buf);
+        ssize_t n = recvmsg(sock, &mh, 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return EXIT_FAILURE;
+
+        struct cmsghdr *cm;
+        for (cm = CMSG_FIRSTHDR(&mh); cm; cm = CMSG_NXTHDR(&mh, cm))
+            if (cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_RIGHTS) {
+                int nb = (cm->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+                memcpy(fds, CMSG_DATA(cm), sizeof(int) * (nb < nfds? nb : nfds));
+            }
+        done += n;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,72 @@
+/* This file is part of jsh.
+ *
+ * jsh: A basic UNIX shell implementation in C
+ * Copyright (C) 2014 Jo Van Bulck <jo.vanbulck@student.kuleuven.be>
+ *
+ * jsh is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * jsh is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with jsh.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ZYGOTE_H_INCLUDED
+#define ZYGOTE_H_INCLUDED
+/* ^^ these are the include guards */
+
+#include "jsh-common.h"
+#include "jsh-parse.h"
+
+extern bool USE_ZYGOTE;     // whether or not commands should be launched by the zygote helper
+
+/*
+ * zygote_start: fork the zygote helper process that will fork/exec commands on behalf
+ *  of the shell. Should be called once at startup, while the shell's heap is still small.
+ * @return: EXIT_SUCCESS or EXIT_FAILURE if the helper couldn't be started
+ */
+int zygote_start(void);
+
+/*
+ * zygote_spawn: let the zygote helper fork and exec the provided comd.
+ * @arg stdinfd  : pipe file descriptor for stdin, or -1
+ * @arg stdoutfd : pipe file descriptor for stdout, or -1
+ * @return: the pid of the launched process, or -1 if the zygote couldn't launch it;
+ *  the caller can then fall back to a normal fork()
+ */
+pid_t zygote_spawn(comd*, int, int);
+
+/*
+ * zygote_pidfd: returns the pidfd of the provided process launched by the zygote, opened by the
+ *  zygote before it could have reaped it, or -1 if none. The caller owns (and closes) it.
+ */
+int zygote_pidfd(pid_t);
+
+/*
+ * zygote_fd: returns the socket that becomes readable when the zygote reports a terminated
+ *  process, or -1 if there is no zygote
+ */
+int zygote_fd(void);
+
+/*
+ * zygote_trywait: non-blocking check for the termination of a process launched by the zygote
+ * @arg status: if non-NULL, filled in with the waitpid() status of the process
+ * @return: the pid of the terminated process, 0 if it is still running, or -1 if the connection
+ *  with the zygote was lost
+ */
+pid_t zygote_trywait(pid_t, int*);
+
+/*
+ * zygote_waitpid: blocking wait for the termination of a process launched by the zygote.
+ * @arg status: if non-NULL, filled in with the waitpid() status of the process
+ * @return: the pid of the terminated process, or -1 on failure
+ */
+pid_t zygote_waitpid(pid_t, int*);
+
+#endif //ZYGOTE_H_INCLUDED
@@ -22,8 +22,15 @@
 #include "alias.h"
 #include "jsh-parse.h"
 #include "jsh-completion.h"
+#include "jsh-zygote.h"
+#include "jsh-event.h"
+#include "jsh-capture.h"
+#include "jsh-queue.h"
+#include "jsh-graph.h"
+#include "jsh-script.h"
+#include "jsh-watch.h"
+#include "jsh-prompt.h"
 #include <signal.h>
-#include <setjmp.h>
 #include <readline/readline.h>      // GNU readline: http://cnswww.cns.cwru.edu/php/chet/readline/rltop.html
 #include <readline/history.h>
 
@@ -36,19 +43,23 @@
 #define LOGIN_FILE              ".jsh_login"
 #define LOGOUT_FILE             ".jsh_logout"
 #define DEFAULT_PROMPT          "%B%u%n@%h[%S]::%f{yellow}%d%f{reset}%$ "    // default init prompt string: "user@host[status]:pwd$ "
-#define MAX_PROMPT_LENGTH       250                 // maximum length of the displayed prompt string
-#define MAX_PROMPT_BUF_LENGTH   50                  // the max number of msd of a status integer in the prompt string
+#define TIMEOUT_KILL_AFTER      5000                // default ms between SIGTERM and SIGKILL for the timeout built_in
+#define HEREDOC_PROMPT          "> "                // prompt string while reading here-document lines
 // ########## function declarations ##########
 void option(char*);
 void things_todo_at_start(void);
 void things_todo_at_exit(void);
 char *getprompt(int);
-char *readcmd(int status);
+char *preparecmd(char*);
+void handle_line(char*);
+void read_input(int, void*);
+void redraw_prompt(int, void*);
+void handle_signal(int);
 int is_built_in(comd*);
 int parse_built_in(comd*, int);
-void sig_int_handler(int);
+int built_in_flags(int);
 void touch_config_files(void);
-char *resolve_prompt_colors(char*);
+void sourcefile(char*, bool);
 
 // ########## global variables ##########
 #ifdef NODEBUG
@@ -69,22 +80,19 @@ char *resolve_prompt_colors(char*);
     bool LOAD_RC = true;
 #endif
 
-bool WAITING_FOR_CHILD = false; // whether or not the jsh parent process is currently (blocking) waiting for child termination
 bool I_AM_FORK = false;
 bool IS_INTERACTIVE;            // initialized in things_todo_at_start; (compiler's 'constant initializer' complaints)
 int nb_hist_entries = 0;        // number of saved hist entries in this jsh session
-sigjmp_buf ctrlc_buf;           // buf used for setjmp/longjmp when SIGINT received
-char *user_prompt_string = "$ ";// initialized in things_todo_at_start function
-int MAX_DIR_LENGTH = 25;        // the maximum length of an expanded pwd substring in the prompt string
+int nb_scripts = 0;             // the nb of script arguments, run in batch mode iff non-zero
 
 /*
  * built_ins[] = array of built_in cmd names; should be sorted with 'qsort(built_ins, nb_built_ins, sizeof(char*), string_cmp);'
  * built_in enum = value corresponds to index in built_ins[]
  */
-const char *built_ins[] = {"", "F", "T", "alias", "cd", "color", "debug",\
-"exit", "history", "prompt", "shcat", "source", "unalias"};
+const char *built_ins[] = {"", "F", "T", "alias", "batch", "capture", "cd", "color", "debug",\
+"exit", "history", "parallel", "prompt", "queue", "replay", "rungraph", "shcat", "source", "tee", "timeout", "unalias", "watch"};
 const size_t nb_built_ins = sizeof(built_ins)/sizeof(built_ins[0]);
-enum built_in {EMPTY, F, T, ALIAS, CD, CLR, DBG, EXIT, HIST, PROMPT, SHCAT, SRC, UNALIAS};
+enum built_in {EMPTY, F, T, ALIAS, BATCH, CAPT, CD, CLR, DBG, EXIT, HIST, PARALLEL, PROMPT, QUEUE, REPLAY, RUNGRAPH, SHCAT, SRC, TEE, TIMEOUT, UNALIAS, WATCH};
 typedef enum built_in built_in;
 
 /*
@@ -95,23 +103,31 @@ typedef enum built_in built_in;
  * TODO read history MAX_HIST_SIZE ofzo??
  */
 int main(int argc, char **argv) {
-    int i, status;
-	// process options
-	for (i = 1; i < argc && *argv[i] == '-'; i++)
-		option(argv[i]+1);
+    int i, jobs = 1;
+    // process options
+    for (i = 1; i < argc && *argv[i] == '-'; i++)
+        if (strcmp(argv[i], "-j") == 0 || strcmp(argv[i], "--jobs") == 0) {
+            if (i+1 == argc || (jobs = parse_jobs(argv[++i])) == -1) {
+                printerr("option '%s' expects the nb of scripts to run in parallel (0: nb of online CPUs)", argv[i-1]);
+                exit(EXIT_FAILURE);
+            }
+        }
+        else
+            option(argv[i]+1);
     
+    // batch mode: run the remaining (script) arguments
+    nb_scripts = argc - i;
     things_todo_at_start();
+    if (nb_scripts > 0)
+        exit(run_scripts(argv + i, nb_scripts, jobs));
     
-    signal(SIGINT, sig_int_handler);
-    // after receiving SIGINT, program is continued on the next line
-    if (sigsetjmp(ctrlc_buf, 1) == 0)
-        status = 0;     // get here on direct call
-    else
-        status = -1;    // get here by SIGINT signal
-    
-    char *s;
-    while ((s = readcmd(status)) != NULL)
-        status = parseexpr(s);
+    // readline's callback interface reads the input char per char from the event loop;
+    //  handle_line() is called for each complete inputline
+    rl_callback_handler_install(getprompt(0), handle_line);
+    if (event_add_fd(fileno(rl_instream), read_input, NULL) != EXIT_SUCCESS ||
+        (IS_INTERACTIVE && event_add_fd(prompt_update_fd(), redraw_prompt, NULL) != EXIT_SUCCESS) ||
+        event_loop(handle_signal) != EXIT_SUCCESS)
+        exit(EXIT_FAILURE);
         
     exit(EXIT_SUCCESS);
 }
@@ -131,6 +147,7 @@ void option(char *str) {
 				break; // else: ignore
 			case 'h':
                 printf("jsh: A basic UNIX shell implementation in C\n");
+                printf("\nUsage: jsh [options] [script ...]\n");
                 printf("\nRecognized options:\n");
                 printf("-h, --help\tdisplay this help message\n");
                 printf("-d, --debug\tturn printing of debug messages on\n");
@@ -138,6 +155,8 @@ void option(char *str) {
                 printf("-c, --color\tturn coloring of jsh output messages on\n");
                 printf("-o, --nocolor\tturn coloring of jsh output messages off\n");
                 printf("-f, --norc\tdisable autoloading of the ~/%s file\n", RCFILE);
+                printf("-z, --zygote\tlaunch commands from a lean pre-forked helper process\n");
+                printf("-j, --jobs N\trun at most N of the provided scripts in parallel (0: nb of online CPUs)\n");
 		        printf("-l, --license\tdisplay licence information\n");
     	        printf("-v, --version\tdisplay version information\n");
     	        printf("\nConfiguration files:\n");
@@ -169,6 +188,9 @@ void option(char *str) {
 		    case 'f':
 		        LOAD_RC = false;
 		        break;
+		    case 'z':
+		        USE_ZYGOTE = true;
+		        break;
 		    case 'l':
 				printf("jsh: A basic UNIX shell implementation in C\n");
                 printf("Copyright (C) 2014 Jo Van Bulck <jo.vanbulck@student.kuleuven.be>\n");
@@ -213,6 +235,8 @@ void optionfull(char *str) {
         option("f");
     else if (strcmp(str,"license") == 0)
         option("l");
+    else if (strcmp(str,"zygote") == 0)
+        option("z");
 	else {
 		printerr("Unrecoginized option '--%s'\n", str);
 		printerr("Try 'jsh --help' for a list of regognized options\n");
@@ -231,7 +255,15 @@ void things_todo_at_start(void) {
     #endif
     
     // evaluate once at startup; to maintain for forked children in a pipeline
-    IS_INTERACTIVE = (isatty(STDIN_FILENO) && isatty(STDOUT_FILENO));
+    IS_INTERACTIVE = (nb_scripts == 0 && isatty(STDIN_FILENO) && isatty(STDOUT_FILENO));
+
+    // route SIGINT, SIGCHLD and SIGWINCH to the event loop
+    if (event_init() != EXIT_SUCCESS)
+        exit(EXIT_FAILURE);
+
+    // start the zygote first, while the address space is still small
+    if (USE_ZYGOTE && zygote_start() != EXIT_SUCCESS)
+        USE_ZYGOTE = false;
 
     touch_config_files();
     
@@ -248,17 +280,19 @@ void things_todo_at_start(void) {
     
     // enable custom rl_autocompletion
     rl_attempted_completion_function = jsh_command_completion;
+    // SIGWINCH is handled from the event loop
+    rl_catch_sigwinch = 0;
     
     // built-in aliases
     alias("~", gethome());
     
     // default prompt
-    user_prompt_string = resolve_prompt_colors(DEFAULT_PROMPT);
+    prompt_compile(DEFAULT_PROMPT);
     
     // read ~/.jshrc if any
     if (LOAD_RC) {
         path = concat(3, gethome(), "/", RCFILE);
-        parsefile(path, (void (*)(char*)) parse_from_file, false);
+        sourcefile(path, false);
         free(path);
     }
     
@@ -274,6 +308,16 @@ void things_todo_at_start(void) {
     }
 }
 
+/*
+ * sourcefile: parse the file at the provided path line per line, like typed input
+ *  (see parsefile() for the errmsg argument); a here-document can't continue after its end
+ */
+void sourcefile(char *path, bool errmsg) {
+    parsefile(path, (void (*)(char*)) parse_from_file, errmsg);
+    if (heredoc_pending())
+        parseline(NULL);
+}
+
 /*
  * create_config_files: looks for the jsh config files;
  *  if not found creates new empty ones (rw-rw-rw; will be combined with current umask)
@@ -311,7 +355,7 @@ void things_todo_at_exit(void) {
         bool dbg = DEBUG;
         DEBUG = false;
         char *path = concat(3, gethome(), "/", LOGOUT_FILE);
-        parsefile(path, (void (*)(char*)) parse_from_file, false);
+        sourcefile(path, false);
         free(path);
         DEBUG = dbg;
         printdebug("'%s' executed", LOGOUT_FILE);
@@ -326,289 +370,86 @@ void things_todo_at_exit(void) {
 }
 
 /*
- * getprompt: return a string representing the command prompt (as defined by the user_prompt_string)
- *  iff IS_INTERACTIVE, else the empty string is returned. The returned string is guaranteed to be less then 
- *  MAX_PROMPT_LENGTH; when a directory is expanded in the prompt string, it is 'smart' truncated to MAX_DIR_LENGTH.
- *  When a status integer or git branch is included in the prompt string, the strings length is truncated to MAX_PROMPT_BUF_LENGTH.
+ * getprompt: return the command prompt, as compiled by prompt_compile(), for the provided exit
+ *  status iff IS_INTERACTIVE; else the empty string is returned
  */
-char* getprompt(int status) {    
-    // static string to hold the current prompt (return value) between function calls
-    static char prompt[MAX_PROMPT_LENGTH] = "";
-    static char buf[MAX_PROMPT_BUF_LENGTH] = "";    // used for char / int to string conversion 
-    
+char* getprompt(int status) {
     if (!IS_INTERACTIVE)
-        return "";    
+        return "";
+    // the commands executed for the prompt (e.g. git, sudo) shouldn't overwrite the captured output
+    bool capture = CAPTURE;
+    CAPTURE = false;
+    char *prompt = prompt_render(status);
+    CAPTURE = capture;
+    return prompt;
+}
 
-    prompt[0] = '\0';               // clear the prev prompt
-    char *next;                     // points to the next substring to add to the prompt
-    int i;
-    for (i = 0; i < strlen(user_prompt_string); i++) {
-        /*** check for '%' prompt expansion options ***/
-        if (user_prompt_string[i] == '%') {
-            i++; // potentially overread the '\0' char (harmless)
-            switch (user_prompt_string[i]) {
-                case 'u':
-                    next = getenv("USER");
-                    break;
-                case 'U':
-                    {
-                    char *username = getenv("USER");
-                    // make the username red and bold when sudo access is activated
-                    // see e.g. http://stackoverflow.com/questions/122276/quickly-check-whether-sudo-permissions-are-available
-                    char *cur_user_has_sudo = strclone("sudo -n true > /dev/null 2> /dev/null");
-	                if (parseexpr(cur_user_has_sudo) == EXIT_SUCCESS) {
-	                    snprintf(buf, MAX_PROMPT_BUF_LENGTH, "%s%s%s", COLOR_BOLD RED_FG, \
-	                        username, COLOR_RESET_BOLD RESET_FG);
-	                    next = buf;
-	                }
-	                else
-	                    next = username;
-	                
-	                free(cur_user_has_sudo);
-                    break;
-                    }
-                case '$':
-                    {
-                    char *cur_user_has_sudo = strclone("sudo -n true > /dev/null 2> /dev/null");
-	                if (parseexpr(cur_user_has_sudo) == EXIT_SUCCESS)
-	                    next = "#";
-	                else
-	                    next = "$";
-	                
-	                free(cur_user_has_sudo);
-                    break;
-                    }
-                case 'h':
-                    {
-                    int hostlen = sysconf(_SC_HOST_NAME_MAX)+1; // Plus one for null terminate
-                    char hostname[hostlen];
-                    gethostname(hostname, hostlen);
-                    hostname[hostlen-1] = '\0'; // Always null-terminate                     
-                    next = hostname;
-                    break;
-                    }
-                case 's':
-                    snprintf(buf, MAX_PROMPT_BUF_LENGTH, "%d", status);
-                    next = buf;
-                    break;
-                case 'S':
-                    if (!status)
-                        snprintf(buf, MAX_PROMPT_BUF_LENGTH, "%d", status);
-                    else
-                        snprintf(buf, MAX_PROMPT_BUF_LENGTH, "%s%d%s", COLOR_BOLD RED_FG, \
-	                        status, COLOR_RESET_BOLD RESET_FG);
-                    next = buf;
-                    break;
-                case 'd':
-                    {
-                    // get the directory                
-                    char *cwd = getcwd(NULL, 0); //TODO portability: this is GNU libc specific... + errchk
-                    
-                    // replace the home dir with '~' if any
-                    char *home = gethome();
-                    if (strstr(cwd, home)) {
-                        cwd = cwd + strlen(home)-1;
-                        cwd[0] = '~';
-                    }
-                    
-                    int cwdlen = strlen(cwd);
-                    char *ptr = NULL;
-                    // get a ptr to the first '/' + 1 within the truncated directory string
-                    if (cwdlen > MAX_DIR_LENGTH) {
-                        ptr = strchr(cwd + cwdlen - MAX_DIR_LENGTH, '/');
-                        ptr = (ptr && ptr < cwd+cwdlen-1)? ptr+1 : ptr;
-                    }
-                    next = ptr? ptr : cwd + ((MAX_DIR_LENGTH < cwdlen) ? cwdlen - MAX_DIR_LENGTH : 0);
-                    break;
-                    }
-                case 'g':
-                    {
-                    char *pwd_is_git = strclone("git rev-parse --git-dir > /dev/null 2> /dev/null");
-	                if (parseexpr(pwd_is_git) == EXIT_SUCCESS) {
-	                    FILE *fp = popen("git symbolic-ref --short -q HEAD", "r");
-	                    buf[0] = ' ';
-	                    buf[1] = '[';
-	                    buf[MAX_PROMPT_BUF_LENGTH-2] = ']';
-	                    buf[MAX_PROMPT_BUF_LENGTH-1] = '\0';
-	                    int j;
-	                    for (j = 2; j < MAX_PROMPT_BUF_LENGTH-2; j++) {
-	                        int cur = getc(fp);
-	                        if (cur == EOF || cur == '\n') {
-	                            buf[j++] = ']';
-	                            buf[j] = '\0';
-	                            break;
-	                        }
-	                        else
-	                            buf[j] = cur;
-	                    }
-	                    next = buf;
-	                    pclose(fp);
-	                }
-	                else
-	                    next = "";
-	                free(pwd_is_git);
-	                break;
-	                }
-	            case 'c':
-	                {
-                    char *pwd_is_git = strclone("git rev-parse --git-dir > /dev/null 2> /dev/null");
-	                char *files_have_changed = strclone("git diff --exit-code > /dev/null 2> /dev/null");                    
-	                if ( (parseexpr(pwd_is_git) == EXIT_SUCCESS) && (parseexpr(files_have_changed) != EXIT_SUCCESS) ) {
-                        snprintf(buf, MAX_PROMPT_BUF_LENGTH, "%s%c%s", COLOR_BOLD RED_FG, \
-	                        '*', COLOR_RESET_BOLD RESET_FG);
-	                    next = buf;
-                    }
-	                else
-	                    next = "";
-	                free(pwd_is_git);
-                    free(files_have_changed);	                
-	                break;
-	                }
-                case '%':
-                    next = "%";
-                    break;
-                default:
-                    printerr("skipping unrecognized prompt option '%%%c'", user_prompt_string[i]);
-                    next = "";
-                    break;
-            }
-        }
-        /*** no prompt expansion; copy the char verbatim ***/        
-        else {
-            sprintf(buf, "%c", user_prompt_string[i]);
-            next = buf;
+/*
+ * handle_line: readline callback for a complete inputline (NULL on EOF): execute it and
+ *  display the prompt for the next one
+ */
+void handle_line(char *line) {
+    int status;
+    if (heredoc_pending()) {
+        // a here-document line: passed verbatim, without history or alias expansion
+        bool eof = (line == NULL);
+        status = parseline(line);
+        free(line);
+        if (eof) {
+            rl_callback_handler_remove();
+            event_loop_stop();
+            return;
         }
-        
-        /*** check length of string to concat; abort to avoid an overflow ***/
-        if ((strlen(prompt) + strlen(next)) >= MAX_PROMPT_LENGTH) {
-            printerr("Prompt expansion too long: not concatting '%s'. Now returning...", next);
-            return prompt;
+    }
+    else {
+        char *s = preparecmd(line);
+        if (s == NULL) {
+            rl_callback_handler_remove();
+            event_loop_stop();
+            return;
         }
-        strcat(prompt, next);
+        status = parseline(s);
+        free(s);
     }
-    return prompt;
+    // a tab in a here-document line is inserted, not completed (e.g. for '<<-')
+    rl_inhibit_completion = (status == HEREDOC_PENDING);
+    if (status == HEREDOC_PENDING) {
+        rl_callback_handler_install(HEREDOC_PROMPT, handle_line);
+        return;
+    }
+    
+    // a ^C meant for the executed command(s) shouldn't clear the next prompt
+    event_interrupted();
+    rl_callback_handler_install(getprompt(status), handle_line);
 }
 
-/**
- * resolve_prompt_colors: return a newly malloced prompt string with the
- *  symbolic color expansion codes replaced with the corresponding ANSI escape codes.
- *  This function can be called once on new promp initialisation to save time on
- *  subsequent prompt re-evaluations.
- * NOTE: the return value is a malloced str with length MAX_PROMPT_LENGTH; when the 
- *  expansion is longer, it is truncated and an error message is written to stdout
+/*
+ * read_input: event loop callback for readable input: let readline process the next char
  */
-char *resolve_prompt_colors(char *prompt) {
-    char *rv = malloc(MAX_PROMPT_LENGTH);
-    rv[0] = '\0';
-    char buf[3]; // to hold the next char and '%' temporarily to append to rv
+void read_input(int fd, void *arg) {
+    rl_callback_read_char();
+}
 
-    // macro to insert a given ANSI escape color value str iff a given name str matches
-    #define CHK_COLOR(cname, cvalue) \
-        if (!strncmp(prompt+i+1, "{" cname "}", strlen("{" cname "}"))) { \
-            next = cvalue; \
-            i += strlen("{" cname "}"); \
-            break; \
-        } 
-    
-    char *next;
-    int i;
-    for (i = 0; i < strlen(prompt); i++) {
-        if (prompt[i] == '%') {
-            i++; // potentially overread the '\0' char (harmless)
-            switch (prompt[i]) {
-                case 'f':
-                    // fg color, normal
-                    CHK_COLOR("black", BLACK_FG)
-                    CHK_COLOR("red", RED_FG)
-                    CHK_COLOR("green", GREEN_FG)
-                    CHK_COLOR("yellow", YELLOW_FG)
-                    CHK_COLOR("blue", BLUE_FG)
-                    CHK_COLOR("magenta", MAGENTA_FG)
-                    CHK_COLOR("cyan", CYAN_FG)
-                    CHK_COLOR("white", WHITE_FG)
-                    CHK_COLOR("reset", RESET_FG)
-                    CHK_COLOR("resetall", COLOR_RESET_ALL)
-                    
-                    printerr("resolve_prompt_colors: skipping empty color prompt option: specify non-bold fg color with '%%f{color_name}'");
-                    next = "";
-                    break;
-                 case 'F':
-                    // fg color, bold
-                    CHK_COLOR("black", COLOR_BOLD BLACK_FG)
-                    CHK_COLOR("red", COLOR_BOLD RED_FG)
-                    CHK_COLOR("green", COLOR_BOLD GREEN_FG)
-                    CHK_COLOR("yellow", COLOR_BOLD YELLOW_FG)
-                    CHK_COLOR("blue", COLOR_BOLD BLUE_FG)
-                    CHK_COLOR("magenta", COLOR_BOLD MAGENTA_FG)
-                    CHK_COLOR("cyan", COLOR_BOLD CYAN_FG)
-                    CHK_COLOR("white", COLOR_BOLD WHITE_FG)
-                    CHK_COLOR("reset", COLOR_RESET_BOLD RESET_FG)
-                    CHK_COLOR("resetall", COLOR_RESET_ALL)
-                    
-                    printerr("resolve_prompt_colors: skipping empty color prompt option: specify bold fg color with '%%f{color_name}'");
-                    next = "";
-                    break;
-                case 'B':
-                    next = COLOR_BOLD;
-                    break;
-                case 'n':
-                    next = COLOR_RESET_BOLD;
-                    break;
-                case 'b':
-                    // bg color, normal
-                    CHK_COLOR("black", BLACK_BG)
-                    CHK_COLOR("red", RED_BG)
-                    CHK_COLOR("green", GREEN_BG)
-                    CHK_COLOR("yellow", YELLOW_BG)
-                    CHK_COLOR("blue", BLUE_BG)
-                    CHK_COLOR("magenta", MAGENTA_BG)
-                    CHK_COLOR("cyan", CYAN_BG)
-                    CHK_COLOR("white", WHITE_BG)
-                    CHK_COLOR("reset", RESET_BG)
-                    CHK_COLOR("resetall", COLOR_RESET_ALL)
-                    
-                    printerr("resolve_prompt_colors: skipping empty color prompt option: specify bg color with '%%b{color_name}'");
-                    next = "";
-                    break;
-                default:
-                    sprintf(buf, "%%%c", prompt[i]);
-                    next = buf;
-                    break;
-            }
-        }
-        /*** no prompt expansion; copy the char verbatim ***/        
-        else {
-            sprintf(buf, "%c", prompt[i]);
-            next = buf;
-        }
-        
-        /*** check length of string to concat; abort to avoid an overflow ***/
-        if ((strlen(rv) + strlen(next)) >= MAX_PROMPT_LENGTH) {
-            printerr("Prompt expansion too long: not concatting '%s'. Now returning...", next);
-            return rv;
-        }
-        strcat(rv, next);
-    }
-    return rv;   
+/*
+ * redraw_prompt: event loop callback for slow prompt segments that completed after the prompt
+ *  was displayed: redraw it in place, keeping the inputline. Only the last line of a multi-line
+ *  prompt is redrawn.
+ */
+void redraw_prompt(int fd, void *arg) {
+    char *prompt = prompt_update();
+    // the here-document and search prompts aren't ours to replace
+    if (heredoc_pending() || RL_ISSTATE(RL_STATE_ISEARCH | RL_STATE_NSEARCH | RL_STATE_COMPLETING))
+        return;
+    rl_set_prompt(prompt);
+    rl_forced_update_display();
 }
 
 /*
- * readcmd: read the next inputline from stdin, add it to the history and resolve all aliases.
- *  returns the resolved inputline or NULL if EOF on a blank line
- * TODO remove status arg?
+ * preparecmd: prepare an inputline read by readline: expand history, add it to the history
+ *  and resolve all aliases. Takes ownership of the provided buf.
+ *  returns the resolved inputline (to be freed) or NULL if EOF on a blank line
  */
-char *readcmd(int status) {
-    /** static variables that remain between function calls **/
-    static char *buf = (char*) NULL;            // inputbuffer for readline()
-    
-    // display prompt and read full line in buf
-    if (buf) {
-        printdebug("readcmd: freeing memory for: '%s'", buf);
-        free(buf); // If the buffer has already been allocated, return the memory to the free pool.
-        buf = NULL;
-    }
-    buf = readline(getprompt(status));  //TODO fall back to getline() when non-interactive...
-    
+char *preparecmd(char *buf) {
     // If the line has any text in it: expand history, save it to history and resolve aliases
     //  (readline returns NULL iff EOF on a blank line)
     if (buf && *buf) {
@@ -623,7 +464,7 @@ char *readcmd(int status) {
             buf = expansion;                // point to expanded cmd
         }
         else {
-            printerr("readcmd: history expansion failed for '%s': '%s'", buf, expansion);
+            printerr("preparecmd: history expansion failed for '%s': '%s'", buf, expansion);
             free(expansion);
         }
         add_history(buf);
@@ -648,6 +489,32 @@ int is_built_in(comd* comd) {
    return ((rv == NULL)? -1: rv - built_ins);
 }
 
+/*
+ * built_in_flags: returns the BUILT_IN_* flags of the built_in with the provided index.
+ *  Built_ins that launch commands or write unbounded output should run in a forked child when
+ *  their stdout is a pipe: else they block on the full pipe before jsh even launched the
+ *  next stage of the pipeline.
+ */
+int built_in_flags(int index) {
+    switch (index) {
+        case BATCH:
+        case HIST:
+        case PARALLEL:
+        case QUEUE:
+        case RUNGRAPH:
+        case SHCAT:
+        case TEE:
+        case WATCH:
+            return BUILT_IN_FORK_IN_PIPE;
+        case TIMEOUT:
+            return BUILT_IN_FORK_IN_PIPE | BUILT_IN_OWN_PROCSUB;
+        case REPLAY:
+            return BUILT_IN_FORK_IN_PIPE | BUILT_IN_NO_CAPTURE;
+        default:
+            return 0;
+    }
+}
+
 /* 
  * parse_built_in: parses the provided *comd as a built_in shell command iff is_built_in(comd) != -1
  *  the provided int is an index in the built_in[] array, as provided by is_built_in(comd)
@@ -698,11 +565,33 @@ int parse_built_in(comd *comd, int index) {
                 printaliases();
                 return EXIT_SUCCESS;
             }
+            else if (comd->length == 4 && strcmp(comd->cmd[1], "-g") == 0)
+                return global_alias(comd->cmd[2], comd->cmd[3]);
             else {
                 CHK_ARGC("alias", 2);
                 return alias(comd->cmd[1], comd->cmd[2]);
             }
             break;
+        case CAPT:
+            {
+            // capture on [size_MiB] | off
+            char *end = "";
+            long mib = CAPTURE_DEFAULT_MIB;
+            if (comd->cmd[1] && strcmp(comd->cmd[1], "off") == 0 && !comd->cmd[2]) {
+                printinfo("capture mode off");
+                return capture_set(0);
+            }
+            if (comd->cmd[1] && strcmp(comd->cmd[1], "on") == 0 && (!comd->cmd[2] || !comd->cmd[3])) {
+                if (comd->cmd[2])
+                    mib = strtol(comd->cmd[2], &end, 10);
+                if (*end == '\0' && mib > 0) {
+                    printinfo("capture mode on (%ld MiB)", mib);
+                    return capture_set((size_t) mib << 20);
+                }
+            }
+            printerr("usage: capture on [size_MiB] | off");
+            return EXIT_FAILURE;
+            }
         case CD:
             { // to allow declarions inside a switch)
             char *dir;
@@ -740,12 +629,34 @@ int parse_built_in(comd *comd, int index) {
             HIST_ENTRY **hlist = history_list();
             int i;
             if (hlist)
-                for (i = 0; hlist[i]; i++)
+                for (i = 0; hlist[i] && !event_interrupted(); i++)
                     printf ("%s\n", hlist[i]->line);
             return EXIT_SUCCESS;
             break;
         case PROMPT:
             {
+            // prompt --profile [n]: render the prompt n times and report the cost of each segment
+            if (comd->length >= 2 && strcmp(comd->cmd[1], "--profile") == 0) {
+                char *end = "";
+                long n = (comd->length == 3)? strtol(comd->cmd[2], &end, 10) : PROMPT_PROFILE_RUNS;
+                if (comd->length > 3 || n <= 0 || *end != '\0') {
+                    printerr("prompt: --profile expects a positive nb of renders");
+                    return EXIT_FAILURE;
+                }
+                return prompt_profile(n);
+            }
+            // prompt -b budget: the max time in ms to wait for the slow prompt segments
+            if (comd->length == 3 && strcmp(comd->cmd[1], "-b") == 0) {
+                char *end;
+                long budget = strtol(comd->cmd[2], &end, 10);
+                if (budget < 0 || *end != '\0' || end == comd->cmd[2]) {
+                    printerr("prompt: -b expects a time budget in ms");
+                    return EXIT_FAILURE;
+                }
+                PROMPT_BUDGET_MS = budget;
+                printdebug("setting PROMPT_BUDGET_MS to %d", PROMPT_BUDGET_MS);
+                return EXIT_SUCCESS;
+            }
             // check for the optional dir length argument
             if (comd->length == 3) {
                 MAX_DIR_LENGTH = abs(atoi(comd->cmd[2]));    // will return 0 on non-integer
@@ -754,24 +665,271 @@ int parse_built_in(comd *comd, int index) {
             else
                 CHK_ARGC("prompt", 1);
             
-            free(user_prompt_string);
-            char *newprompt = resolve_prompt_colors(comd->cmd[1]);
-            printdebug("setting user_prompt_string to '%s'", newprompt);
-            user_prompt_string = newprompt;
+            printdebug("setting the prompt to '%s'", comd->cmd[1]);
+            prompt_compile(comd->cmd[1]);
             return EXIT_SUCCESS;
             break;
             }
         case SHCAT:
-            parsestream(stdin, "stdin", (void (*)(char*)) puts_verbatim);  // built_in cat; mainly for testing purposes (redirecting stdin)
-            return EXIT_SUCCESS;
+            {
+            // built_in cat: shcat [file ...]; copies stdin if no files are provided
+            int i, fd, rv = EXIT_SUCCESS;
+            fflush(stdout);
+            if (!comd->cmd[1] && copy_fd(STDIN_FILENO, STDOUT_FILENO) != EXIT_SUCCESS) {
+                printerrno("shcat: copying stdin failed");
+                rv = EXIT_FAILURE;
+            }
+            for (i = 1; comd->cmd[i]; i++)
+                if ((fd = open(comd->cmd[i], O_RDONLY)) < 0 || copy_fd(fd, STDOUT_FILENO) != EXIT_SUCCESS) {
+                    printerrno("shcat: '%s'", comd->cmd[i]);
+                    rv = EXIT_FAILURE;
+                    if (fd >= 0) close(fd);
+                }
+                else
+                    close(fd);
+            return rv;
+            break;
+            }
+        case TEE:
+            {
+            // tee [-a] [file ...]: copy stdin to all files and stdout
+            int i, argi = (comd->cmd[1] && strcmp(comd->cmd[1], "-a") == 0)? 2 : 1;
+            int nouts = 0, outs[comd->length - argi + 1], rv = EXIT_SUCCESS;
+            for (i = argi; comd->cmd[i]; i++) {
+                // note: splice() can't write to O_APPEND files, so -a takes the read() / write() path
+                int fd = open(comd->cmd[i], O_WRONLY | O_CREAT | ((argi == 2)? O_APPEND : O_TRUNC), 0666);
+                if (fd < 0) {
+                    printerrno("tee: '%s'", comd->cmd[i]);
+                    rv = EXIT_FAILURE;
+                    if (fd >= 0) close(fd);
+                }
+                else
+                    outs[nouts++] = fd;
+            }
+            outs[nouts++] = STDOUT_FILENO;  // note: last, to get the original (not duplicated) data
+            fflush(stdout);
+            if (tee_fd(STDIN_FILENO, outs, nouts) != EXIT_SUCCESS) {
+                printerrno("tee: copying stdin failed");
+                rv = EXIT_FAILURE;
+            }
+            for (i = 0; i < nouts-1; i++)
+                close(outs[i]);
+            return rv;
+            break;
+            }
+        case TIMEOUT:
+            {
+            // timeout [-k kill_after] duration cmd [args]
+            int argi = 1;
+            long kill_ms = TIMEOUT_KILL_AFTER;
+            if (comd->cmd[1] && strcmp(comd->cmd[1], "-k") == 0 && comd->cmd[2]) {
+                kill_ms = parse_duration(comd->cmd[2]);
+                argi = 3;
+            }
+            long timeout_ms = comd->cmd[argi]? parse_duration(comd->cmd[argi]) : -1;
+            if (timeout_ms < 0 || kill_ms < 0 || !comd->cmd[argi+1]) {
+                printerr("usage: timeout [-k kill_after] duration cmd [args]");
+                return EXIT_FAILURE;
+            }
+            // note: like coreutils, a duration of 0 or 'inf' disables the timeout (or the kill)
+            if (timeout_ms == 0 || timeout_ms == DURATION_INFINITE)
+                timeout_ms = -1;
+            if (kill_ms == 0 || kill_ms == DURATION_INFINITE)
+                kill_ms = -1;
+            return timeout_cmd(comd->cmd + argi + 1, timeout_ms, kill_ms);
+            break;
+            }
+        case BATCH:
+            {
+            // batch [-P max_procs] cmd [fixed_args {:::|--}] args
+            int argi = 1, max_procs = 1;
+            if (comd->cmd[1] && strcmp(comd->cmd[1], "-P") == 0 && comd->cmd[2]) {
+                max_procs = parse_jobs(comd->cmd[2]);
+                argi = 3;
+            }
+            if (max_procs <= 0 || !comd->cmd[argi]) {
+                printerr("usage: batch [-P max_procs] cmd [fixed_args {:::|--}] args");
+                return EXIT_FAILURE;
+            }
+            return batch_cmd(comd->cmd + argi, max_procs);
+            break;
+            }
+        case PARALLEL:
+            {
+            // parallel [-j jobs] [-g] cmd [args] [::: input ...]: without ':::', an input per line of stdin
+            int argi, sep, ninputs = 0, max_procs = online_cpus();
+            bool group = false;
+            for (argi = 1; comd->cmd[argi] && *comd->cmd[argi] == '-' && max_procs > 0; argi++)
+                if (strcmp(comd->cmd[argi], "-g") == 0)
+                    group = true;
+                else if (strcmp(comd->cmd[argi], "-j") == 0 && comd->cmd[argi+1])
+                    max_procs = parse_jobs(comd->cmd[++argi]);
+                else
+                    max_procs = -1;
+            for (sep = argi; comd->cmd[sep] && strcmp(comd->cmd[sep], ":::") != 0; sep++);
+            if (max_procs <= 0 || sep == argi) {
+                printerr("usage: parallel [-j jobs] [-g] cmd [args] [::: input ...]");
+                return EXIT_FAILURE;
+            }
+            char *buf = NULL, *p;
+            char **inputs;
+            if (comd->cmd[sep]) {
+                comd->cmd[sep] = NULL;
+                for (ninputs = 0; comd->cmd[sep+1+ninputs]; ninputs++);
+                inputs = malloc(sizeof(char*) * (ninputs+1));
+                memcpy(inputs, comd->cmd + sep + 1, sizeof(char*) * ninputs);
+            }
+            else {
+                if ((buf = read_fd(STDIN_FILENO, NULL)) == NULL) {
+                    if (errno != EINTR)     // else stopped by ^C
+                        printerrno("parallel: couldn't read the inputs from stdin");
+                    return EXIT_FAILURE;
+                }
+                for (p = buf; (p = strchr(p, '\n')) != NULL; p++)
+                    ninputs++;
+                inputs = malloc(sizeof(char*) * (ninputs+1));
+                for (ninputs = 0, p = buf; *p; ) {
+                    inputs[ninputs++] = p;
+                    if ((p = strchr(p, '\n')) == NULL)
+                        break;
+                    *p++ = '\0';
+                }
+            }
+            fflush(stdout);
+            int rv = parallel_cmd(comd->cmd + argi, inputs, ninputs, max_procs, group);
+            free(inputs);
+            free(buf);
+            return rv;
             break;
+            }
+        case QUEUE:
+            {
+            // queue [add [-p priority] cmd [args] | list | wait [id] | log id | limit [max] | clear]
+            char *sub = comd->cmd[1]? comd->cmd[1] : "list", *end;
+            char *arg = comd->cmd[1]? comd->cmd[2] : NULL;
+            long n = arg? strtol(arg, &end, 10) : -1;
+            bool numeric = arg && *end == '\0' && n >= 0;
+            bool changes = strcmp(sub, "add") == 0 || strcmp(sub, "wait") == 0 || strcmp(sub, "clear") == 0 ||
+                (strcmp(sub, "limit") == 0 && arg);
+            if (changes && I_AM_FORK) {
+                // note: the queue (and the tasks to wait for) belong to the jsh process itself
+                printerr("queue: can't '%s' in a pipeline or subshell", sub);
+                return EXIT_FAILURE;
+            }
+            if (strcmp(sub, "add") == 0 && arg) {
+                int i, priority = 0, argi = 2;
+                if (strcmp(arg, "-p") == 0 && comd->cmd[3] && comd->cmd[4]) {
+                    priority = strtol(comd->cmd[3], &end, 10);
+                    argi = (*end == '\0')? 4 : -1;
+                }
+                if (argi == -1) {
+                    printerr("queue: invalid priority: '%s'", comd->cmd[3]);
+                    return EXIT_FAILURE;
+                }
+                // a single argument is a cmd line, e.g. queue add "make && make install";
+                //  else the arguments are quoted where needed, e.g. queue add sh -c "a; b"
+                size_t len = 1;
+                for (i = argi; comd->cmd[i]; i++)
+                    len += 2 * strlen(comd->cmd[i]) + 3;
+                char *line = malloc(len), *p = line, *c;
+                for (i = argi; comd->cmd[i]; i++) {
+                    bool quote = comd->cmd[argi+1] && comd->cmd[i][strcspn(comd->cmd[i], " \t;|&<>()#\"\\")];
+                    p += sprintf(p, "%s%s", (i > argi)? " " : "", quote? "\"" : "");
+                    for (c = comd->cmd[i]; *c; c++) {
+                        if (quote && (*c == '"' || *c == '\\'))
+                            *p++ = '\\';
+                        *p++ = *c;
+                    }
+                    p += sprintf(p, "%s", quote? "\"" : "");
+                }
+                int id = queue_add(line, priority);
+                free(line);
+                if (id == -1)
+                    return EXIT_FAILURE;
+                printf("%d\n", id);
+                return EXIT_SUCCESS;
+            }
+            else if (strcmp(sub, "list") == 0 && !arg) {
+                queue_list();
+                return EXIT_SUCCESS;
+            }
+            else if (strcmp(sub, "wait") == 0 && (!arg || numeric)) {
+                return queue_wait(n);
+            }
+            else if (strcmp(sub, "log") == 0 && numeric) {
+                fflush(stdout);
+                return queue_log(n, STDOUT_FILENO);
+            }
+            else if (strcmp(sub, "limit") == 0 && (!arg || (n = parse_jobs(arg)) != -1)) {
+                if (arg)
+                    queue_set_limit(n);
+                else
+                    printf("%d\n", queue_get_limit());
+                return EXIT_SUCCESS;
+            }
+            else if (strcmp(sub, "clear") == 0 && !arg) {
+                queue_clear();
+                return EXIT_SUCCESS;
+            }
+            printerr("usage: queue [add [-p priority] cmd [args] | list | wait [id] | log id | limit [max] | clear]");
+            return EXIT_FAILURE;
+            break;
+            }
+        case REPLAY:
+            if (comd->cmd[1]) {
+                printerr("usage: replay");
+                return EXIT_FAILURE;
+            }
+            if (!CAPTURE) {
+                printerr("replay: capture mode is off; turn it on with 'capture on'");
+                return EXIT_FAILURE;
+            }
+            fflush(stdout);
+            return capture_replay(STDOUT_FILENO);
+            break;
+        case RUNGRAPH:
+            {
+            // rungraph [-j workers] file
+            int argi = 1, workers = online_cpus();
+            if (comd->cmd[argi] && strcmp(comd->cmd[argi], "-j") == 0 && comd->cmd[argi+1]) {
+                workers = parse_jobs(comd->cmd[++argi]);
+                argi++;
+            }
+            if (workers <= 0 || comd->cmd[argi] == NULL || comd->cmd[argi+1] != NULL) {
+                printerr("usage: rungraph [-j workers] file");
+                return EXIT_FAILURE;
+            }
+            return rungraph(comd->cmd[argi], workers);
+            break;
+            }
         case UNALIAS:
             CHK_ARGC("unalias", 1);
             return unalias(comd->cmd[1]);
             break;
+        case WATCH:
+            {
+            // watch [-r] [-d debounce] path ... -- cmd [args]
+            int argi, sep;
+            long debounce_ms = WATCH_DEBOUNCE_MS;
+            bool restart = false;
+            for (argi = 1; comd->cmd[argi] && *comd->cmd[argi] == '-' && debounce_ms >= 0; argi++)
+                if (strcmp(comd->cmd[argi], "-r") == 0)
+                    restart = true;
+                else if (strcmp(comd->cmd[argi], "-d") == 0 && comd->cmd[argi+1])
+                    debounce_ms = parse_duration(comd->cmd[++argi]);
+                else
+                    debounce_ms = -1;
+            for (sep = argi; comd->cmd[sep] && strcmp(comd->cmd[sep], "--") != 0; sep++);
+            if (debounce_ms < 0 || debounce_ms == DURATION_INFINITE || sep == argi || comd->cmd[sep] == NULL || comd->cmd[sep+1] == NULL) {
+                printerr("usage: watch [-r] [-d debounce] path ... -- cmd [args]");
+                return EXIT_FAILURE;
+            }
+            return watch_cmd(comd->cmd + argi, sep - argi, comd->cmd + sep + 1, debounce_ms, restart);
+            break;
+            }
 		case SRC:
 			CHK_ARGC("source", 1);
-			parsefile(comd->cmd[1], (void (*)(char*)) parse_from_file, true); // errormsg if file not found
+			sourcefile(comd->cmd[1], true); // errormsg if file not found
 			return EXIT_SUCCESS;
 			break;
         default:
@@ -781,14 +939,23 @@ int parse_built_in(comd *comd, int index) {
 }
 
 /*
- * sig_int_handler: this function is called when the user enters ^C and 
- * tells GNU readline to diplay a prompt on a newline
+ * handle_signal: called from the event loop when the user enters ^C (SIGINT) or the
+ *  terminal is resized (SIGWINCH). ^C discards the current inputline and tells GNU
+ *  readline to display a prompt on a newline.
  */
-void sig_int_handler(int signo) {
-    // if ^C entered in child process --> also sent to parent (jsh) process
-    // --> only clear the prompt when not waiting for an executing child (allow the waitpid to return)
-    if (!WAITING_FOR_CHILD) {
-        rl_crlf();                  // set cursor to newline
-        siglongjmp(ctrlc_buf, 1);   // jump back to main loop
+void handle_signal(int signo) {
+    if (signo == SIGWINCH) {
+        rl_resize_terminal();
+        return;
     }
+    rl_free_line_state();
+    #if RL_VERSION_MAJOR >= 7
+        rl_callback_sigcleanup();
+    #endif
+    rl_replace_line("", 0);
+    rl_crlf();                  // set cursor to newline
+    heredoc_discard();
+    rl_inhibit_completion = 0;
+    rl_callback_handler_remove();
+    rl_callback_handler_install(getprompt(-1), handle_line);
 }